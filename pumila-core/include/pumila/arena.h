@@ -0,0 +1,106 @@
+#pragma once
+#include "def.h"
+#include "chain.h"
+#include "game.h"
+#include "step.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace PUMILA_NS {
+/*!
+ * \brief 2つのpolicyを多数のGameSimの対戦で戦わせる
+ *
+ * 各ゲームは同じ配ぷよの2人をsetOpponentSimでつないだもので、
+ * スレッドプールの各スレッドが終わったゲームの次のゲームを取りに行くので
+ * ゲームの長さがばらばらでも全スレッドが埋まる。
+ * 時間はGameSim::fastForward()で進め、GameSim::headlessにするので
+ * 描画用の待ち時間も表示用の盤面もかからない
+ */
+class Arena {
+  public:
+    /*!
+     * \brief current_step (field_before, op_field_before) から
+     * actionsのindexを返す
+     *
+     * 複数のゲームから同時に呼ばれるのでスレッドセーフであること
+     */
+    using Policy = std::function<int(const StepResult &)>;
+
+    /*!
+     * \brief seedと盤面から決まるランダムなaction
+     */
+    PUMILA_DLL static Policy randomPolicy(std::uint64_t seed);
+    /*!
+     * \brief すぐに消える連鎖の点数が最大になるaction
+     * (同点ならゲームオーバーにならない、最も低く置けるもの)
+     */
+    PUMILA_DLL static Policy greedyPolicy();
+
+    struct GameResult {
+        /*!
+         * \brief 勝ったプレイヤー (0 or 1)、引き分けは-1
+         *
+         * 両方同時にゲームオーバーになるか、max_framesに達したら引き分け
+         */
+        int winner = -1;
+        int frames = 0;
+        std::array<int, 2> score = {};
+        /*!
+         * \brief 各プレイヤーのStepResult (recordがtrueのときのみ)
+         */
+        std::array<std::vector<std::shared_ptr<StepResult>>, 2> steps;
+    };
+    struct Result {
+        std::size_t games = 0;
+        std::array<std::size_t, 2> wins = {};
+        std::size_t draws = 0;
+        std::array<long long, 2> score_sum = {};
+        /*!
+         * \brief chain_hist[p][n]: プレイヤーpのn連鎖のターン数 (0連鎖を含む)
+         */
+        std::array<std::array<std::size_t, MAX_CHAIN_NUM + 1>, 2> chain_hist =
+            {};
+        long long frames_sum = 0;
+        /*!
+         * \brief 各ゲームの結果 (recordがtrueのときのみ)
+         */
+        std::vector<GameResult> records;
+    };
+
+    std::array<Policy, 2> policies;
+    bool enable_garbage = true;
+    /*!
+     * \brief 1ゲームの最大フレーム数
+     */
+    int max_frames = 60 * 60 * 10;
+    /*!
+     * \brief 各ゲームのGameResultとStepResultを残すかどうか
+     */
+    bool record = false;
+
+    Arena(Policy policy0, Policy policy1)
+        : policies({std::move(policy0), std::move(policy1)}) {}
+
+    /*!
+     * \brief 1ゲームを (呼び出したスレッドで) 行う
+     * \param stats nullptrでなければ勝敗などをこれに加算する
+     * (recordsには追加しない)
+     */
+    PUMILA_DLL GameResult playGame(typename std::mt19937::result_type seed,
+                                   Result *stats = nullptr) const;
+    /*!
+     * \brief games回の対戦をスレッドプールで並列に行い、集計する
+     *
+     * i番目のゲームの配ぷよはseedとiから決まるので、結果はスレッド数によらない。
+     * policyが範囲外のactionを返した場合は std::out_of_range を投げる。
+     * policyの中でスレッドプールのタスクを待つとデッドロックするので、
+     * 特徴量はPumila14::calcActionTo()などで計算すること
+     */
+    PUMILA_DLL Result run(std::size_t games, std::uint64_t seed) const;
+};
+} // namespace PUMILA_NS
@@ -0,0 +1,304 @@
+#pragma once
+#include "def.h"
+#include <cstddef>
+#include <cstdint>
+#include <bit>
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+namespace PUMILA_NS {
+/*!
+ * \brief フィールドの各マスを1bitで表したもの
+ *
+ * 列優先で1列16bit (y=0がLSB)、x=0〜3の列がlo、x=4,5の列がhiに入る。
+ * フィールド外 (y>=13) のbitは常に0に保つ
+ */
+struct BitBoard {
+    static constexpr std::size_t WIDTH = 6;
+    static constexpr std::size_t HEIGHT = 13;
+    static constexpr std::size_t COL_BITS = 16;
+    static constexpr std::uint16_t COL_MASK = (1u << HEIGHT) - 1;
+    static constexpr std::uint64_t LO_MASK = 0x1fff1fff1fff1fffull;
+    static constexpr std::uint64_t HI_MASK = 0x000000001fff1fffull;
+
+    std::uint64_t lo = 0, hi = 0;
+
+    constexpr BitBoard() = default;
+    constexpr BitBoard(std::uint64_t lo, std::uint64_t hi) : lo(lo), hi(hi) {}
+
+    /*!
+     * \brief フィールド全体が1のBitBoard
+     */
+    static constexpr BitBoard full() { return {LO_MASK, HI_MASK}; }
+    /*!
+     * \brief x, yの1マスだけが1のBitBoard
+     */
+    static constexpr BitBoard cell(std::size_t x, std::size_t y) {
+        return x < 4 ? BitBoard{1ull << (x * COL_BITS + y), 0}
+                     : BitBoard{0, 1ull << ((x - 4) * COL_BITS + y)};
+    }
+    /*!
+     * \brief columns のbit xが1の列全体が1のBitBoard
+     */
+    static constexpr BitBoard columns(unsigned columns) {
+        BitBoard b;
+        for (std::size_t x = 0; x < WIDTH; x++) {
+            if (columns & (1u << x)) {
+                b.setColumn(x, COL_MASK);
+            }
+        }
+        return b;
+    }
+    /*!
+     * \brief x列目のy<heightのマスが1のBitBoard
+     */
+    static constexpr BitBoard below(std::size_t x, std::size_t height) {
+        BitBoard b;
+        b.setColumn(x, static_cast<std::uint16_t>((1u << height) - 1));
+        return b;
+    }
+
+    constexpr bool test(std::size_t x, std::size_t y) const {
+        return !(*this & cell(x, y)).empty();
+    }
+    constexpr void set(std::size_t x, std::size_t y) { *this |= cell(x, y); }
+    constexpr void reset(std::size_t x, std::size_t y) {
+        *this &= ~cell(x, y);
+    }
+
+    /*!
+     * \brief x列目の16bitを取得
+     */
+    constexpr std::uint16_t column(std::size_t x) const {
+        return static_cast<std::uint16_t>(
+            x < 4 ? lo >> (x * COL_BITS) : hi >> ((x - 4) * COL_BITS));
+    }
+    /*!
+     * \brief x列目の16bitを上書き
+     */
+    constexpr void setColumn(std::size_t x, std::uint16_t col) {
+        std::uint64_t c = col & COL_MASK;
+        if (x < 4) {
+            lo = (lo & ~(0xffffull << (x * COL_BITS))) | (c << (x * COL_BITS));
+        } else {
+            hi = (hi & ~(0xffffull << ((x - 4) * COL_BITS))) |
+                 (c << ((x - 4) * COL_BITS));
+        }
+    }
+    /*!
+     * \brief x列目の一番上のぷよの1つ上のy座標 (空なら0)
+     */
+    constexpr std::size_t height(std::size_t x) const {
+        return std::bit_width(column(x));
+    }
+
+    constexpr bool empty() const { return (lo | hi) == 0; }
+    /*!
+     * \brief 下から隙間なく詰まっていない列 (x列目→bit x)
+     */
+    constexpr unsigned gapColumns() const {
+        unsigned columns = 0;
+        for (std::size_t x = 0; x < WIDTH; x++) {
+            std::uint16_t col = column(x);
+            if ((col & (col + 1)) != 0) {
+                columns |= 1u << x;
+            }
+        }
+        return columns;
+    }
+    /*!
+     * \brief 1のマスのうち列優先で最初の1マスだけを残したもの
+     */
+    constexpr BitBoard lowest() const {
+        return lo ? BitBoard{lo & (~lo + 1), 0} : BitBoard{0, hi & (~hi + 1)};
+    }
+    /*!
+     * \brief 1のマスのうち y→x の順 (行優先) で最初のマスの番号
+     * (y * WIDTH + x)、空ならWIDTH * HEIGHT
+     */
+    constexpr std::size_t firstRowMajor() const {
+        std::size_t first = WIDTH * HEIGHT;
+        for (std::size_t x = 0; x < WIDTH; x++) {
+            std::uint16_t col = column(x);
+            if (col) {
+                std::size_t i = std::countr_zero(col) * WIDTH + x;
+                first = i < first ? i : first;
+            }
+        }
+        return first;
+    }
+    constexpr int popcount() const {
+        return std::popcount(lo) + std::popcount(hi);
+    }
+
+    constexpr BitBoard operator&(const BitBoard &b) const {
+        return {lo & b.lo, hi & b.hi};
+    }
+    constexpr BitBoard operator|(const BitBoard &b) const {
+        return {lo | b.lo, hi | b.hi};
+    }
+    constexpr BitBoard operator^(const BitBoard &b) const {
+        return {lo ^ b.lo, hi ^ b.hi};
+    }
+    /*!
+     * \brief フィールド内のみ反転
+     */
+    constexpr BitBoard operator~() const {
+        return {~lo & LO_MASK, ~hi & HI_MASK};
+    }
+    constexpr BitBoard &operator&=(const BitBoard &b) {
+        return *this = *this & b;
+    }
+    constexpr BitBoard &operator|=(const BitBoard &b) {
+        return *this = *this | b;
+    }
+    constexpr BitBoard &operator^=(const BitBoard &b) {
+        return *this = *this ^ b;
+    }
+    constexpr bool operator==(const BitBoard &b) const {
+        return lo == b.lo && hi == b.hi;
+    }
+    constexpr bool operator!=(const BitBoard &b) const { return !(*this == b); }
+
+    /*!
+     * \brief 全体を1マス上 (y+1) にずらす
+     */
+    constexpr BitBoard up() const {
+        return {(lo << 1) & LO_MASK, (hi << 1) & HI_MASK};
+    }
+    /*!
+     * \brief 全体を1マス下 (y-1) にずらす
+     */
+    constexpr BitBoard down() const {
+        return {(lo >> 1) & LO_MASK, (hi >> 1) & HI_MASK};
+    }
+    /*!
+     * \brief 全体を1マス右 (x+1) にずらす
+     */
+    constexpr BitBoard right() const {
+        return {lo << COL_BITS, ((hi << COL_BITS) | (lo >> 48)) & HI_MASK};
+    }
+    /*!
+     * \brief 全体を1マス左 (x-1) にずらす
+     */
+    constexpr BitBoard left() const {
+        return {(lo >> COL_BITS) | (hi << 48), hi >> COL_BITS};
+    }
+    /*!
+     * \brief 上下左右に隣接するマス (自身は含まない)
+     */
+    constexpr BitBoard neighbors() const {
+        return up() | down() | right() | left();
+    }
+    /*!
+     * \brief seedからmask内で上下左右につながっているマスをすべて返す
+     */
+    constexpr static BitBoard floodFill(BitBoard seed, const BitBoard &mask) {
+        seed &= mask;
+        while (true) {
+            BitBoard next = (seed | seed.neighbors()) & mask;
+            if (next == seed) {
+                return seed;
+            }
+            seed = next;
+        }
+    }
+
+    /*!
+     * \brief 1のマスを y→x の順 (行優先) に列挙する
+     * \param f void(std::size_t x, std::size_t y)
+     */
+    template <typename F>
+    constexpr void forEachRowMajor(F &&f) const {
+        for (std::size_t y = 0; y < HEIGHT; y++) {
+            for (std::size_t x = 0; x < WIDTH; x++) {
+                if (test(x, y)) {
+                    f(x, y);
+                }
+            }
+        }
+    }
+};
+
+/*!
+ * \brief 各列ごとに、maskが1のマスだけを取り出して下に詰める
+ * (列ごとのpext)
+ *
+ * 同じmaskで複数のBitBoardを詰めることが多いので、maskから計算できる部分は
+ * コンストラクタで済ませておく。
+ * BMI2が使える場合はpext/pdep、そうでなければ16bitレーンごとの
+ * compress (Hacker's Delight 7-4) をビット並列で行う。
+ * どちらも列の中身によらず一定時間
+ */
+class ColumnCompressor {
+    BitBoard mask;
+    /*!
+     * \brief 詰めた後のmask (各列の下からpopcount個が1)
+     */
+    BitBoard packed;
+#if !defined(__BMI2__)
+    /*!
+     * \brief 2^iマス動かすbit
+     */
+    std::uint64_t move_lo[4], move_hi[4];
+
+    /*!
+     * \brief 16bitレーンごとにkbit左シフト
+     */
+    static constexpr std::uint64_t laneShl(std::uint64_t v, int k) {
+        return (v << k) & (((0xffffull << k) & 0xffff) * 0x0001000100010001ull);
+    }
+    static constexpr void prepare(std::uint64_t m, std::uint64_t (&mv)[4]) {
+        std::uint64_t mk = laneShl(~m, 1);
+        for (int i = 0; i < 4; i++) {
+            std::uint64_t mp = mk ^ laneShl(mk, 1);
+            mp ^= laneShl(mp, 2);
+            mp ^= laneShl(mp, 4);
+            mp ^= laneShl(mp, 8);
+            mv[i] = mp & m;
+            m = (m ^ mv[i]) | (mv[i] >> (1 << i));
+            mk &= ~mp;
+        }
+    }
+    static constexpr std::uint64_t apply(std::uint64_t v,
+                                         const std::uint64_t (&mv)[4]) {
+        for (int i = 0; i < 4; i++) {
+            std::uint64_t t = v & mv[i];
+            v = (v ^ t) | (t >> (1 << i));
+        }
+        return v;
+    }
+#endif
+
+  public:
+    explicit constexpr ColumnCompressor(const BitBoard &mask)
+        : mask(mask), packed() {
+        for (std::size_t x = 0; x < BitBoard::WIDTH; x++) {
+            packed.setColumn(x, static_cast<std::uint16_t>(
+                                    (1u << std::popcount(mask.column(x))) - 1));
+        }
+#if !defined(__BMI2__)
+        prepare(mask.lo, move_lo);
+        prepare(mask.hi, move_hi);
+#endif
+    }
+    /*!
+     * \brief 詰めた後のmask
+     */
+    constexpr const BitBoard &packedMask() const { return packed; }
+    /*!
+     * \brief 各列ごとにmaskが1のマスのみ取り出して下に詰めたもの
+     */
+    BitBoard operator()(const BitBoard &b) const {
+#if defined(__BMI2__)
+        return {_pdep_u64(_pext_u64(b.lo, mask.lo), packed.lo),
+                _pdep_u64(_pext_u64(b.hi, mask.hi), packed.hi)};
+#else
+        return {apply(b.lo & mask.lo, move_lo),
+                apply(b.hi & mask.hi, move_hi)};
+#endif
+    }
+};
+
+} // namespace PUMILA_NS
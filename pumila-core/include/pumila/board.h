@@ -0,0 +1,283 @@
+#pragma once
+#include "def.h"
+#include "action.h"
+#include "bitboard.h"
+#include "chain.h"
+#include "static_vector.h"
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace PUMILA_NS {
+/*!
+ * \brief 同じ色でつながっているぷよのまとまり
+ */
+struct PuyoGroup {
+    Puyo color = Puyo::none;
+    /*!
+     * \brief ぷよの数
+     */
+    int size = 0;
+    BitBoard mask;
+    /*!
+     * \brief 隣接しているおじゃま (いっしょに消える)
+     */
+    BitBoard garbage;
+};
+/*!
+ * \brief PuyoBoard::findGroups() の結果
+ *
+ * 盤面のマス数を超えることはないので固定長
+ */
+using PuyoGroupList =
+    StaticVector<PuyoGroup, BitBoard::WIDTH * BitBoard::HEIGHT>;
+
+/*!
+ * \brief フィールドの盤面部分のみ
+ *
+ * ロックなし、trivially copyable なのでコピーはmemcpyと同等。
+ * ネクストやおじゃまなどはFieldState3が持つ
+ */
+class PuyoBoard {
+  public:
+    static constexpr std::size_t WIDTH = BitBoard::WIDTH;
+    static constexpr std::size_t HEIGHT = BitBoard::HEIGHT;
+    /*!
+     * \brief red, blue, green, yellow, purple, garbage の6色
+     */
+    static constexpr std::size_t PLANE_NUM = 6;
+
+  private:
+    /*!
+     * \brief 色ごとのぷよの位置
+     */
+    std::array<BitBoard, PLANE_NUM> planes;
+
+    /*!
+     * \brief 盤面が変化したかどうか
+     * * set時にtrue
+     * * deleteChainでchanged=trueのみチェック
+     * * putNext時にクリア
+     */
+    BitBoard updated;
+
+  public:
+    /*!
+     * \brief 各列の高さ
+     */
+    using Heights = std::array<std::uint8_t, BitBoard::WIDTH>;
+
+  private:
+    /*!
+     * \brief 各列の一番上のぷよの1つ上のy座標
+     *
+     * planesを変更するたびに変化した列のみ更新する
+     */
+    Heights column_heights;
+    /*!
+     * \brief planesのZobristハッシュ
+     *
+     * (色, マス) ごとの乱数のxor。planesを変更するたびに
+     * 変化したbitの分だけ更新する (toggleHash())
+     */
+    std::uint64_t zobrist;
+
+    /*!
+     * \brief planes[i]のdiffのbitが反転したときのzobristの更新
+     */
+    PUMILA_DLL void toggleHash(std::size_t i, const BitBoard &diff);
+    /*!
+     * \brief zobristをplanesから計算しなおす
+     */
+    PUMILA_DLL void rehash();
+
+    /*!
+     * \brief columns (x列目→bit x) の列のcolumn_heightsを計算しなおす
+     */
+    void updateHeights(unsigned columns) {
+        BitBoard occ = occupied();
+        for (std::size_t x = 0; x < WIDTH; x++) {
+            if (columns & (1u << x)) {
+                column_heights[x] = static_cast<std::uint8_t>(occ.height(x));
+            }
+        }
+    }
+
+    static std::size_t planeIndex(Puyo p) {
+        return static_cast<std::size_t>(p) - 1;
+    }
+    static Puyo planePuyo(std::size_t i) { return static_cast<Puyo>(i + 1); }
+
+  public:
+    PuyoBoard() : planes(), updated(), column_heights(), zobrist(0) {}
+
+    /*!
+     * \brief x, yがフィールドの範囲内かどうか判定
+     */
+    static bool inRange(std::size_t x, std::size_t y = 0) {
+        return x < WIDTH && y < HEIGHT;
+    }
+    /*!
+     * \brief フィールドを取得
+     */
+    PUMILA_DLL Puyo get(std::size_t x, std::size_t y) const;
+    /*!
+     * \brief フィールドを上書き
+     */
+    PUMILA_DLL void set(std::size_t x, std::size_t y, Puyo p);
+
+    /*!
+     * \brief 色pのぷよのあるマス
+     */
+    const BitBoard &plane(Puyo p) const { return planes[planeIndex(p)]; }
+    /*!
+     * \brief 色ぷよ(garbage以外)のあるマス
+     */
+    BitBoard colored() const {
+        return planes[0] | planes[1] | planes[2] | planes[3] | planes[4];
+    }
+    /*!
+     * \brief ぷよのあるマス
+     */
+    BitBoard occupied() const {
+        return colored() | planes[planeIndex(Puyo::garbage)];
+    }
+
+    /*!
+     * \brief x列目の一番上のぷよの1つ上のy座標 (空なら0)
+     */
+    std::size_t getHeight(std::size_t x) const {
+        assert(inRange(x) && "out of range in PuyoBoard::getHeight");
+        return column_heights[x];
+    }
+    /*!
+     * \brief 全列の高さ
+     */
+    const Heights &heights() const { return column_heights; }
+
+    /*!
+     * \brief updatedをクリア
+     */
+    void clearUpdated() { updated = {}; }
+
+    /*!
+     * \brief x, y とつながっている同じ色のぷよ
+     */
+    PUMILA_DLL BitBoard connection(std::size_t x, std::size_t y) const;
+    /*!
+     * \brief 盤面の色ぷよのつながりをすべて調べる
+     *
+     * 再帰もヒープ確保もせず、色ごとにBitBoardの膨張を繰り返して求める
+     *
+     * \param seeds このマスを含むつながりのみ返す
+     * \param min_size これより小さいつながりは返さない
+     * \return 色 (red→purple) 順、同じ色の中では列優先で最初のマス順
+     */
+    PUMILA_DLL PuyoGroupList
+    findGroups(const BitBoard &seeds = BitBoard::full(), int min_size = 1) const;
+    /*!
+     * \brief 色ぷよのマスと、それに隣接するおじゃまをフィールドから消す
+     */
+    PUMILA_DLL void deleteConnection(const BitBoard &deleted);
+    /*!
+     * \brief findGroups()で求めたつながり(と隣接おじゃま)を消す
+     */
+    void deleteConnection(const PuyoGroup &group) {
+        deleteCells(group.mask | group.garbage);
+    }
+    /*!
+     * \brief 指定したマスを種類を問わず消す
+     */
+    PUMILA_DLL void deleteCells(const BitBoard &cleared);
+
+    /*!
+     * \brief 4連結を探し、消す
+     * * updatedのマスを含むつながりをfindGroups()で1回だけ調べ、
+     *   4個以上のものと隣接するおじゃまをその場で消す (盤面のコピーはしない)
+     * * 盤面に4連結が無かった場合何もせず消したぷよの数は0として返る
+     * \param chain_num 連鎖数(1連鎖目→1)
+     * \return 消したぷよの情報
+     */
+    Chain deleteChain(std::size_t chain_num) {
+        return deleteChain(chain_num, updated);
+    }
+    /*!
+     * \brief seedsのマスを含むつながりのみ調べる
+     *
+     * seedsはupdatedのうち前回のdeleteChain以降に変化したマスを含んでいること
+     */
+    PUMILA_DLL Chain deleteChain(std::size_t chain_num, const BitBoard &seeds);
+    /*!
+     * \brief 空中に浮いているぷよを落とす
+     *
+     * 列ごとのpext (ColumnCompressor) で全色まとめて一定時間で詰める
+     *
+     * \return 落ちたぷよがあった列 (x列目→bit x)
+     */
+    PUMILA_DLL unsigned fallColumns();
+    /*!
+     * \brief 空中に浮いているぷよを落とす
+     * \return 落ちたぷよがあったらtrue
+     */
+    bool fall() { return fallColumns() != 0; }
+    /*!
+     * \brief 連鎖が止まるまでdeleteChain,fallをする
+     * \param chains 各連鎖の情報が追加される (ヒープを使わない)
+     *
+     * chainsがいっぱいになったらそこで止める (残りの連鎖は盤面に残る)
+     */
+    PUMILA_DLL void deleteChainRecurse(ChainList &chains);
+    /*!
+     * \brief 連鎖が止まるまでdeleteChain,fallをする
+     */
+    PUMILA_DLL std::vector<Chain> deleteChainRecurse();
+    /*!
+     * \brief 連鎖が止まるまでdeleteChain,fallをし、点数などのみ返す
+     *
+     * Chainを作らず、つながりの並べ替えもしない。
+     * 盤面の変化はdeleteChainRecurse()と同じ。
+     * garbageは0のまま (FieldState3::deleteChainSummary()で計算する)
+     */
+    PUMILA_DLL ChainSummary deleteChainSummary();
+
+    using ChainMap = std::array<std::array<std::size_t, WIDTH>, HEIGHT>;
+    /*!
+     * \brief 盤面の各マスについて消したら何連鎖が起きるかを計算する
+     *
+     * * つながりごとに1回だけ、盤面(PuyoBoard)のコピー上で連鎖させる
+     * * 消しても上のぷよが落ちないつながりは0連鎖なので計算しない
+     * * updatedは無視する (連鎖の残っていない盤面を前提とする)ので、
+     *   結果は盤面(planes)のみで決まる → ChainAllCacheでキャッシュできる
+     */
+    PUMILA_DLL ChainMap calcChainAll() const;
+
+    /*!
+     * \brief 盤面(planes)のハッシュ値 (Zobrist、変更時に更新済み)
+     *
+     * 同じ盤面ならどの手順で作っても同じ値になる
+     */
+    std::uint64_t hash() const { return zobrist; }
+
+    /*!
+     * \brief 1マス3bitで詰めた盤面
+     *
+     * マスk (= x * HEIGHT + y) の値 (Puyoの値, 0〜6) のbit jを
+     * 全体の j * 78 + k bit目に置く。updatedは含まない
+     */
+    using Packed = std::array<std::uint64_t, 4>;
+    PUMILA_DLL Packed pack() const;
+    /*!
+     * \brief pack()から盤面を復元する (updatedは空)
+     */
+    PUMILA_DLL static PuyoBoard unpack(const Packed &packed);
+    bool operator==(const PuyoBoard &other) const {
+        return planes == other.planes;
+    }
+    bool operator!=(const PuyoBoard &other) const { return !(*this == other); }
+};
+static_assert(std::is_trivially_copyable_v<PuyoBoard>);
+
+} // namespace PUMILA_NS
@@ -1,12 +1,17 @@
 #pragma once
 #include "def.h"
 #include "action.h"
-#include <vector>
+#include "bitboard.h"
+#include "static_vector.h"
+#include <array>
+#include <type_traits>
 #include <utility>
 
 namespace PUMILA_NS {
 struct PuyoConnection {
-    std::vector<std::pair<std::size_t, std::size_t>> colored, garbage;
+    static constexpr std::size_t CAPACITY = BitBoard::WIDTH * BitBoard::HEIGHT;
+    StaticVector<std::pair<std::size_t, std::size_t>, CAPACITY> colored,
+        garbage;
     PuyoConnection() : colored(), garbage() {}
 };
 /*!
@@ -20,17 +25,26 @@ struct Chain {
      * 例えば赤4連結+青5連結の9個なら{{red, 4}, {blue, 5}}で、
      * connectionNum() = 9
      */
-    std::vector<std::pair<Puyo, int>> connections;
+    static constexpr std::size_t MAX_CONNECTIONS =
+        BitBoard::WIDTH * BitBoard::HEIGHT / 4;
+    StaticVector<std::pair<Puyo, int>, MAX_CONNECTIONS> connections;
     int chain_num;
-    explicit Chain(int chain_num)
-        : connections(), chain_num(chain_num){}
+    explicit Chain(int chain_num) : connections(), chain_num(chain_num) {}
     void push_connection(Puyo p, int n);
     bool isEmpty() const { return connections.empty(); }
     PUMILA_DLL int connectionNum() const;
     int chainBonus() const { return chainBonus(chain_num); }
     PUMILA_DLL static int chainBonus(int chain_num);
     PUMILA_DLL int connectionBonus() const;
+    /*!
+     * \brief connection個の連結1つ分の連結ボーナス
+     */
+    PUMILA_DLL static int connectionBonus(int connection);
     PUMILA_DLL int colorBonus() const;
+    /*!
+     * \brief color_num色消したときの色数ボーナス
+     */
+    PUMILA_DLL static int colorBonus(int color_num);
     PUMILA_DLL int scoreA() const;
     PUMILA_DLL int scoreB() const;
     int score() const { return scoreA() * scoreB(); };
@@ -39,4 +53,42 @@ struct Chain {
     bool operator!=(const Chain &other) const { return !(*this == other); }
 };
 
+/*!
+ * \brief 1回の連鎖の全体
+ *
+ * 1連鎖で4個以上消えるので連鎖数は盤面のマス数/4を超えない
+ */
+constexpr std::size_t MAX_CHAIN_NUM = BitBoard::WIDTH * BitBoard::HEIGHT / 4;
+using ChainList = StaticVector<Chain, MAX_CHAIN_NUM>;
+
+/*!
+ * \brief 1回の連鎖全体の結果の要約
+ *
+ * Chainのリストを作らずに点数だけ計算する場合に使う (PuyoBoard::deleteChainSummary())
+ */
+struct ChainSummary {
+    /*!
+     * \brief 連鎖数
+     */
+    int chain_num = 0;
+    /*!
+     * \brief 各連鎖の点数 (scores[0]が1連鎖目、chain_num個まで有効)
+     */
+    std::array<int, MAX_CHAIN_NUM> scores = {};
+    int total_score = 0;
+    /*!
+     * \brief 消えた色ぷよの数
+     */
+    int connection_num = 0;
+    /*!
+     * \brief 送るおじゃまの数 (相殺前)
+     */
+    std::size_t garbage = 0;
+    /*!
+     * \brief 連鎖の後フィールドが空になったかどうか
+     */
+    bool all_clear = false;
+};
+static_assert(std::is_trivially_copyable_v<ChainSummary>);
+
 } // namespace PUMILA_NS
@@ -0,0 +1,39 @@
+#pragma once
+#include "def.h"
+#include "board.h"
+#include "sharded_cache.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace PUMILA_NS {
+/*!
+ * \brief PuyoBoard::calcChainAll() の結果を盤面のハッシュで引くキャッシュ
+ *
+ * ShardedCacheのキーに盤面そのものを持ち、
+ * ハッシュが一致しても盤面が違えばミス
+ */
+class ChainAllCache {
+    using ChainMapPacked =
+        std::array<std::uint8_t, PuyoBoard::WIDTH * PuyoBoard::HEIGHT>;
+    ShardedCache<PuyoBoard, ChainMapPacked> cache;
+
+  public:
+    /*!
+     * \param capacity 保持する盤面の数
+     */
+    PUMILA_DLL explicit ChainAllCache(std::size_t capacity = 1 << 14);
+    ChainAllCache(const ChainAllCache &) = delete;
+    ChainAllCache &operator=(const ChainAllCache &) = delete;
+
+    /*!
+     * \brief キャッシュにあればそれを、なければ計算して保存して返す
+     */
+    PUMILA_DLL PuyoBoard::ChainMap calcChainAll(const PuyoBoard &board);
+
+    std::size_t capacity() const { return cache.capacity(); }
+    std::size_t hits() const { return cache.hits(); }
+    std::size_t misses() const { return cache.misses(); }
+    void clear() { cache.clear(); }
+};
+} // namespace PUMILA_NS
@@ -1,11 +1,13 @@
 #pragma once
 #include "def.h"
+#include "board.h"
+#include "tsumo.h"
 #include <cstddef>
+#include <cstdint>
 #include <array>
+#include <functional>
 #include <memory>
-#include <random>
 #include <vector>
-#include <mutex>
 #include "action.h"
 #include "garbage.h"
 #include "chain.h"
@@ -14,60 +16,40 @@ namespace PUMILA_NS {
 /*!
  * \brief ある瞬間のフィールドの状態。
  * 履歴は含まなくていい
+ *
+ * ロックしないので、複数スレッドから共有する場合はSharedFieldState3を使う
  */
 class FieldState3 {
-    mutable std::recursive_mutex mtx;
-
   public:
-    static constexpr std::size_t WIDTH = 6;
-    static constexpr std::size_t HEIGHT = 13;
+    static constexpr std::size_t WIDTH = PuyoBoard::WIDTH;
+    static constexpr std::size_t HEIGHT = PuyoBoard::HEIGHT;
 
   private:
-    std::array<std::array<Puyo, WIDTH>, HEIGHT> field;
+    PuyoBoard board;
 
+    static constexpr std::size_t NextNum = 3;
     /*!
-     * \brief x, y とつながっているぷよの数を数え、フィールドから消す
+     * \brief 配ぷよの列 (他のFieldState3と共有)
+     * nullptrの場合nextはすべてnone
      */
-    PUMILA_DLL void deleteConnectionImpl(std::size_t x, std::size_t y,
-                                         PuyoConnection &deleted);
+    std::shared_ptr<const Tsumo> tsumo;
     /*!
-     * \brief x, y とつながっているぷよの数を数え、フィールドから消す
-     * \return 削除したぷよ
+     * \brief 操作中のぷよのtsumo上の位置
      */
-    PUMILA_DLL PuyoConnection deleteConnection(std::size_t x, std::size_t y);
-
+    std::size_t tsumo_index;
     /*!
-     * \brief 盤面が変化したかどうか
-     * * set時にtrue
-     * * deleteChainでchanged=trueのみチェック
-     * * putNext時にクリア
+     * \brief 操作中のぷよ(位置情報を含む)
      */
-    std::array<std::array<bool, WIDTH>, HEIGHT> updated;
+    PuyoPair current;
     /*!
-     * \brief updatedをクリア
-     */
-    PUMILA_DLL void clearUpdated();
-
-    static constexpr std::size_t NextNum = 3;
-    std::mt19937 rnd_next;
-    /*!
-     * \brief 乱数を1進める
-     */
-    PUMILA_DLL Puyo nextColor();
-
-    /*!
-     * \brief nextのぷよ(操作中の位置情報を含む)
-     */
-    std::array<PuyoPair, NextNum> next;
-    /*!
-     * \brief nextを1つすすめて補充
+     * \brief nextを1つすすめる
      */
     PUMILA_DLL void shiftNext();
 
     /*!
      * \brief 自フィールドに降るおじゃま
      */
-    std::vector<std::shared_ptr<GarbageGroup>> garbage_ready;
+    GarbageQueue garbage_ready;
     /*!
      * \brief おじゃま計算用スコア
      */
@@ -75,64 +57,124 @@ class FieldState3 {
 
     int total_score;
 
+    /*!
+     * \brief おじゃまの配置に使う乱数のseed (tsumoのseedと同じ)
+     */
+    std::uint64_t garbage_seed;
+    /*!
+     * \brief putGarbageで端数のおじゃまを降らせた回数
+     *
+     * 乱数はgarbage_seedとこの回数だけから決まるので、
+     * seedからゲームを再現でき、スレッド間で共有する状態もない
+     */
+    std::uint64_t garbage_put_count;
+
   public:
+    /*!
+     * \brief おじゃまの配置に使うPhiloxEngineのstream (上位32bit)
+     */
+    static constexpr std::uint64_t GARBAGE_STREAM = 1ull << 32;
+
     FieldState3()
-        : field(), updated(), rnd_next(), next(), garbage_ready(),
-          garbage_score(0), total_score(0) {}
-    explicit FieldState3(std::uint_fast32_t seed) : FieldState3() {
-        rnd_next.seed(seed);
-        for (std::size_t i = 0; i < NextNum; i++) {
-            shiftNext();
+        : board(), tsumo(), tsumo_index(0), current(), garbage_ready(),
+          garbage_score(0), total_score(0), garbage_seed(0),
+          garbage_put_count(0) {}
+    explicit FieldState3(std::shared_ptr<const Tsumo> tsumo) : FieldState3() {
+        this->tsumo = std::move(tsumo);
+        if (this->tsumo) {
+            current = this->tsumo->pair(0);
+            garbage_seed = this->tsumo->seed();
         }
     }
+    /*!
+     * \brief 同じseedのFieldState3どうしはTsumoを共有する
+     */
+    explicit FieldState3(std::uint_fast32_t seed)
+        : FieldState3(Tsumo::share(seed)) {}
 
-    FieldState3(const FieldState3 &other) : FieldState3() { *this = other; }
-    FieldState3(FieldState3 &&other) : FieldState3() {
-        *this = std::move(other);
-    }
-    FieldState3 &operator=(const FieldState3 &other) {
-        std::lock_guard lock(other.mtx);
-        field = other.field;
-        updated = other.updated;
-        rnd_next = other.rnd_next;
-        next = other.next;
-        garbage_ready = other.garbage_ready;
-        garbage_score = other.garbage_score;
-        total_score = other.total_score;
-        return *this;
-    }
-    FieldState3 &operator=(FieldState3 &&other) {
-        std::lock_guard lock(other.mtx);
-        field = std::move(other.field);
-        updated = std::move(other.updated);
-        rnd_next = std::move(other.rnd_next);
-        next = std::move(other.next);
-        garbage_ready = std::move(other.garbage_ready);
-        garbage_score = other.garbage_score;
-        total_score = other.total_score;
-        return *this;
-    }
+    /*!
+     * \brief 状態を64バイトに詰めたもの (比較・ハッシュ・保存用)
+     *
+     * 盤面 (1マス3bit)、操作中とnextのぷよ、tsumoのseedと位置、
+     * おじゃまの残り数、スコアとおじゃま計算の端数を持つ。
+     * 操作中のぷよのy座標とGarbageGroupへの参照は含まない
+     */
+    struct Packed {
+        /*!
+         * \brief nextsの、tsumoがあるかどうかのbit
+         */
+        static constexpr std::uint32_t HAS_TSUMO = 1u << 23;
+
+        PuyoBoard::Packed board;
+        /*!
+         * \brief Tsumo::seed() (64bitのseedもそのまま持つ)
+         */
+        std::uint64_t tsumo_seed;
+        std::uint32_t tsumo_index;
+        /*!
+         * \brief getNext(0〜2)の(bottom, top)の色を3bitずつ、
+         * その上に操作中のぷよのx (3bit), rot (2bit), HAS_TSUMO
+         */
+        std::uint32_t nexts;
+        std::uint32_t garbage_num;
+        std::uint32_t garbage_put_count;
+        std::int32_t garbage_score;
+        std::int32_t total_score;
+
+        bool operator==(const Packed &other) const {
+            return board == other.board && tsumo_seed == other.tsumo_seed &&
+                   tsumo_index == other.tsumo_index && nexts == other.nexts &&
+                   garbage_num == other.garbage_num &&
+                   garbage_put_count == other.garbage_put_count &&
+                   garbage_score == other.garbage_score &&
+                   total_score == other.total_score;
+        }
+        bool operator!=(const Packed &other) const { return !(*this == other); }
+        /*!
+         * \brief 全体の64bitハッシュ
+         */
+        PUMILA_DLL std::uint64_t hash() const;
+    };
+    /*!
+     * \brief 状態を詰める
+     */
+    PUMILA_DLL Packed pack() const;
+    /*!
+     * \brief pack()から復元する
+     *
+     * tsumoはTsumo::share()で共有し、おじゃまはどのGarbageGroupにも
+     * 報告しない (detached()と同じ)。updatedは空になる
+     */
+    PUMILA_DLL static FieldState3 unpack(const Packed &packed);
 
     /*!
      * \brief x, yがフィールドの範囲内かどうか判定
      *
      */
     static bool inRange(std::size_t x, std::size_t y = 0) {
-        return x < WIDTH && y < HEIGHT;
+        return PuyoBoard::inRange(x, y);
     }
     /*!
      * \brief フィールドを取得
      */
-    PUMILA_DLL Puyo get(std::size_t x, std::size_t y) const;
+    Puyo get(std::size_t x, std::size_t y) const { return board.get(x, y); }
     /*!
      * \brief フィールドを上書き
      */
-    PUMILA_DLL void set(std::size_t x, std::size_t y, Puyo p);
+    void set(std::size_t x, std::size_t y, Puyo p) { board.set(x, y, p); }
+    /*!
+     * \brief 盤面部分を取得
+     */
+    const PuyoBoard &getBoard() const { return board; }
 
     /*!
      * \brief i番目のnextを取得
      */
     PUMILA_DLL PuyoPair getNext(std::size_t i) const;
+    /*!
+     * \brief 配ぷよの列
+     */
+    const std::shared_ptr<const Tsumo> &getTsumo() const { return tsumo; }
     /*!
      * \brief next[0]を上書き
      */
@@ -141,8 +183,28 @@ class FieldState3 {
     /*!
      * \brief 相手からのおじゃまを追加
      * \param garbage 送られてきたおじゃま nullptrも可
+     *
+     * 相殺・落下はgarbageに報告されるので、
+     * このフィールドで降り終わるまで呼び出し側がgarbageを保持すること
+     * (fieldにはポインタのみ保存する)。
+     * GarbageQueue::CAPACITY個たまっていたら std::length_error を投げる
      */
     PUMILA_DLL void addGarbage(const std::shared_ptr<GarbageGroup> &garbage);
+    /*!
+     * \brief どのGarbageGroupにも報告しないおじゃまをnum個追加
+     * (記録の再生用)
+     */
+    void addGarbage(std::size_t num) { garbage_ready.push(nullptr, num); }
+    /*!
+     * \brief GarbageGroupへの報告をやめたコピー
+     *
+     * StepResultなど、GarbageGroupより長く残るかもしれないスナップショットに使う
+     */
+    FieldState3 detached() const {
+        FieldState3 copy = *this;
+        copy.garbage_ready.detach();
+        return copy;
+    }
     /*!
      * \brief 現在のおじゃまを取得
      */
@@ -150,7 +212,10 @@ class FieldState3 {
     /*!
      * \brief garbageを降らせる:
      * garbageReadyを0にする or 30減らす
-     * \param garbage_list おじゃまが降った位置が返る
+     *
+     * 埋まっている列 (高さHEIGHT) に降るおじゃまは置かずに消えるが、
+     * garbage_readyとGarbageGroupには降った数として数える
+     * \param garbage_list おじゃまが降った位置が返る (消えた分は入らない)
      */
     PUMILA_DLL void putGarbage(std::vector<std::pair<std::size_t, std::size_t>>
                                    *garbage_list = nullptr);
@@ -175,12 +240,41 @@ class FieldState3 {
     std::pair<std::size_t, std::size_t> getNextHeight() const {
         return getNextHeight(getNext(0));
     }
-    PUMILA_DLL std::size_t getHeight(std::size_t x) const;
+    std::size_t getHeight(std::size_t x) const { return board.getHeight(x); }
+    /*!
+     * \brief 全列の高さ (盤面の変更時に更新されているので参照するだけ)
+     */
+    const PuyoBoard::Heights &heights() const { return board.heights(); }
+    /*!
+     * \brief 置ける (2つとも盤面に収まる) actionsのbitmask
+     * (bit aがactions[a])
+     *
+     * ぷよは13段目より上に出てきて、12段目より上にいる間は
+     * どの列の上も横切れるので、途中の列の高さでは制限されない。
+     * 各列の高さごとに置けるactionsを前計算した表を引くだけなので速い
+     */
+    PUMILA_DLL std::uint32_t legalActions() const;
+    static constexpr std::uint32_t ALL_ACTIONS = (1u << ACTIONS_NUM) - 1;
+    /*!
+     * \brief 置いた結果の盤面が同じになるactionsをまとめる
+     * \return 各actionについて、同じ盤面になる最小のaction
+     * (置けないactionは-1)
+     *
+     * 同じ色の組では、縦置きと逆向きの縦置き、
+     * 横置きと1列ずれた逆向きの横置きが重なる。
+     * 2つのぷよが落ちるマスと色だけで判定するので盤面はコピーしない
+     */
+    PUMILA_DLL std::array<int, ACTIONS_NUM> placementGroups() const;
+
     /*!
      * \brief 落下中のぷよが既存のぷよに重なっているまたは画面外か調べる
      * \return フィールド上のぷよと重なるor画面外ならtrue
      */
     PUMILA_DLL bool checkNextCollision(const Action &action) const;
+    /*!
+     * \brief ppの位置 (yを含む) で重なっているか調べる
+     */
+    PUMILA_DLL bool checkNextCollision(const PuyoPair &pp) const;
     bool checkNextCollision() const { return checkNextCollision(getNext(0)); }
 
     /*!
@@ -203,23 +297,41 @@ class FieldState3 {
      * \brief 空中に浮いているぷよを落とす
      * \return 落ちたぷよがあったらtrue
      */
-    PUMILA_DLL bool fall();
+    bool fall() { return board.fall(); }
 
     /*!
      * \brief 連鎖が止まるまでdeleteChain,fallをする
      */
     PUMILA_DLL std::vector<Chain> deleteChainRecurse();
+    /*!
+     * \brief ヒープを使わない版
+     */
+    PUMILA_DLL void deleteChainRecurse(ChainList &chains);
+    /*!
+     * \brief 連鎖が止まるまでdeleteChain,fallをし、点数などのみ返す
+     * * total_scoreに追加
+     * * garbageはgarbage_scoreの端数を含めて計算するが、
+     *   garbage_scoreは変更しない (calcGarbageで別途加算する)
+     */
+    PUMILA_DLL ChainSummary deleteChainSummary();
 
     /*!
      * \brief 盤面の各マスについて消したら何連鎖が起きるかを計算する
      */
-    PUMILA_DLL std::array<std::array<std::size_t, WIDTH>, HEIGHT>
-    calcChainAll() const;
+    PuyoBoard::ChainMap calcChainAll() const { return board.calcChainAll(); }
 
-    PUMILA_DLL int totalScore() const;
+    int totalScore() const { return total_score; }
     /*!
      * \brief 11,2を調べ埋まっているかどうか返す
      */
     bool isGameOver() const { return get(2, 11) != Puyo::none; }
 };
+static_assert(sizeof(FieldState3::Packed) == 64);
 } // namespace PUMILA_NS
+
+template <>
+struct std::hash<PUMILA_NS::FieldState3::Packed> {
+    std::size_t operator()(const PUMILA_NS::FieldState3::Packed &p) const {
+        return static_cast<std::size_t>(p.hash());
+    }
+};
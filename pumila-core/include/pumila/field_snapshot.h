@@ -0,0 +1,55 @@
+#pragma once
+#include "def.h"
+#include "field3.h"
+#include <cassert>
+#include <memory>
+#include <optional>
+
+namespace PUMILA_NS {
+/*!
+ * \brief 変更できないFieldState3の共有スナップショット
+ *
+ * コピーはポインタのコピーのみで、同じ時点の盤面を記録する
+ * StepResult同士 (前ターンのfield_afterと次ターンのfield_before、
+ * 自分のfieldと相手から見たop_fieldなど) で中身を共有する。
+ * デフォルト構築したものは空 (std::optionalのnulloptと同じ扱い)
+ */
+class FieldSnapshot {
+    std::shared_ptr<const FieldState3> field;
+
+  public:
+    FieldSnapshot() = default;
+    /*!
+     * \brief fieldをコピーしてスナップショットにする
+     *
+     * GarbageGroupへの報告はしない (FieldState3::detached())
+     */
+    explicit FieldSnapshot(const FieldState3 &field)
+        : field(std::make_shared<const FieldState3>(field.detached())) {}
+
+    bool has_value() const { return field != nullptr; }
+    explicit operator bool() const { return has_value(); }
+
+    const FieldState3 &operator*() const {
+        assert(field && "FieldSnapshot has no value");
+        return *field;
+    }
+    const FieldState3 *operator->() const { return &**this; }
+    /*!
+     * \brief 変更可能なコピー (空ならnullopt)
+     */
+    std::optional<FieldState3> copy() const {
+        if (!field) {
+            return std::nullopt;
+        }
+        return *field;
+    }
+
+    /*!
+     * \brief 同じ盤面を共有しているかどうか
+     */
+    bool sharesWith(const FieldSnapshot &other) const {
+        return field == other.field;
+    }
+};
+} // namespace PUMILA_NS
@@ -1,11 +1,20 @@
 #pragma once
 #include "def.h"
 #include "field3.h"
+#include "shared_field3.h"
 #include "chain.h"
+#include "game_record.h"
 #include "pumila/step.h"
+#include "soft_put_planner.h"
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <limits>
 #include <random>
 #include <memory>
 #include <optional>
+#include <utility>
+#include <variant>
 #include <vector>
 
 namespace PUMILA_NS {
@@ -22,6 +31,17 @@ class GameSim : public std::enable_shared_from_this<GameSim> {
     // std::optional<std::thread> model_action_thread;
     // std::atomic<bool> running;
     std::optional<Action> soft_put_target = std::nullopt;
+    /*!
+     * \brief soft_put_targetまでの入力列 (SoftPutPlanner) と次に使うフレーム
+     * 置けない目標の場合nullptrで、1つずつ近づける
+     */
+    std::shared_ptr<const SoftPutPlanner::Plan> soft_put_plan = nullptr;
+    std::size_t soft_put_plan_pos = 0;
+    bool soft_put_planned = false;
+    /*!
+     * \brief soft_put_targetに向けて1フレーム分操作する
+     */
+    void stepSoftPut();
 
     /*!
      * \brief rotPairして失敗した場合その回転方向が入る
@@ -31,6 +51,16 @@ class GameSim : public std::enable_shared_from_this<GameSim> {
     int rot_fail_count = 0;
     static constexpr int ROT_FAIL_COUNT = 10;
 
+    /*!
+     * \brief current_stepをsnapshot()と共有しているかどうか
+     */
+    mutable bool current_step_shared = false;
+    /*!
+     * \brief current_stepを書き換える前に呼ぶ:
+     * snapshot()と共有していればclone()して置き換える
+     */
+    StepResult &writableStep();
+
   public:
     bool enable_garbage;
 
@@ -39,7 +69,10 @@ class GameSim : public std::enable_shared_from_this<GameSim> {
      */
     std::weak_ptr<GameSim> opponent;
 
-    std::optional<FieldState3> field;
+    /*!
+     * \brief 相手のGameSimからもアクセスされるのでロック付き
+     */
+    SharedFieldState3 field;
     // PUMILA_DLL std::optional<FieldState2> field2();
     // PUMILA_DLL std::shared_ptr<FieldState> field1();
 
@@ -49,6 +82,14 @@ class GameSim : public std::enable_shared_from_this<GameSim> {
     int soft_put_interval = 6;
     int soft_put_cnt = 0;
 
+    /*!
+     * \brief trueにするとFallPhaseでdisplay_fieldを作らない (学習用)
+     *
+     * 連鎖の処理は自分のfieldでの1回だけになり、
+     * FallPhaseのフレームはすべてfastForward()でまとめて飛ばせる
+     */
+    bool headless = false;
+
     bool is_over = false;
 
     /*!
@@ -56,32 +97,44 @@ class GameSim : public std::enable_shared_from_this<GameSim> {
      * reset()で0からスタート
      */
     int step_count = 0;
+    /*!
+     * \brief reset()からのフレーム数
+     * (step()とfastForward()で飛ばしたフレームを含む)
+     */
+    int frame_count = 0;
 
+    /*!
+     * \brief セットすると次のreset()から各ターンを記録する
+     */
+    std::shared_ptr<GameRecordWriter> recorder;
+
+    /*!
+     * \brief 各フェーズの共通部分
+     *
+     * 各フェーズはPhaseHolderの中にvariantとして直接置かれるので、
+     * 仮想関数もヒープ確保も使わない
+     */
     struct Phase {
         GameSim *sim;
         explicit Phase(GameSim *sim) : sim(sim) {}
-        virtual ~Phase() {}
-        /*!
-         * \brief 処理を1周期進める
-         *
-         * \return 別のフェーズに移行する場合新しいフェーズ、
-         * そうでなければnullptr
-         *
-         */
-        virtual std::unique_ptr<Phase> step() = 0;
         enum PhaseEnum {
             none,
             free,
             fall,
             garbage,
         };
-        virtual PhaseEnum get() const = 0;
     };
-    std::unique_ptr<Phase> phase;
+    struct FreePhase;
+    struct FallPhase;
+    struct GarbagePhase;
+    class PhaseHolder;
 
     /*!
      * \brief FreePhaseに入る時に作られ、
      * Fall, GarbagePhaseで情報が更新される
+     *
+     * snapshot()の後に更新する場合は、snapshotとは別のオブジェクトに
+     * 置き換えてから更新する
      */
     std::shared_ptr<StepResult> current_step;
 
@@ -118,6 +171,28 @@ class GameSim : public std::enable_shared_from_this<GameSim> {
      *
      */
     PUMILA_DLL void movePair(int dx);
+    /*!
+     * \brief movePair()の判定部分: ppをdx動かせればppを変更してtrue
+     */
+    PUMILA_DLL static bool tryMovePair(const FieldState3 &field, PuyoPair &pp,
+                                       int dx);
+    /*!
+     * \brief rotPair()の判定部分: ppをr回転できればppを変更する
+     * \return 0: 回転できない, 1: そのまま回転した, 2: ずらして回転した
+     */
+    PUMILA_DLL static int tryRotPair(const FieldState3 &field, PuyoPair &pp,
+                                     int r);
+    /*!
+     * \brief rotPair()の規則で回転する: 直前に同じ向きの回転が失敗していれば
+     * 2回転し、ずらした回転と失敗をrot_fail_countに数える
+     * (ROT_FAIL_COUNTに達したら何もしない)
+     *
+     * softPut()の入力列もこれで動かすので、手で操作した場合と同じになる
+     * \return tryRotPair()の結果
+     */
+    PUMILA_DLL static int applyRotPair(const FieldState3 &field, PuyoPair &pp,
+                                       int r, int &rot_fail,
+                                       int &rot_fail_count);
     PUMILA_DLL void rotPair(int r);
     PUMILA_DLL void quickDrop();
     PUMILA_DLL void softDrop();
@@ -128,6 +203,35 @@ class GameSim : public std::enable_shared_from_this<GameSim> {
      */
     PUMILA_DLL void step();
 
+    /*!
+     * \brief FreePhaseで、まだput()もsoftPut()もしていない
+     */
+    PUMILA_DLL bool needsAction() const;
+    /*!
+     * \brief 次のstep()から何回の間、タイマーが減るだけで何も起きないか
+     */
+    PUMILA_DLL int idleFrames() const;
+    /*!
+     * \brief 何も起きないフレームをまとめて飛ばして時間を進める (学習用)
+     *
+     * 毎フレームsimsの順にstep()を呼ぶのと同じ結果になるが、
+     * 全員のタイマーが減るだけのフレームはstep()を呼ばずにまとめて進める
+     * (2人の相対的なタイミングはフレーム単位で同じ)。
+     * いずれかのsimがneedsAction()になるか、max_framesに達したら止まる
+     *
+     * \return 進めたフレーム数
+     */
+    PUMILA_DLL static int
+    fastForward(const std::vector<std::shared_ptr<GameSim>> &sims,
+                int max_frames = std::numeric_limits<int>::max());
+    /*!
+     * \brief actionで置き、相手とともに次にどちらかが
+     * needsAction()になるまでfastForward()する
+     *
+     * \return 進めたフレーム数
+     */
+    PUMILA_DLL int putTurn(const Action &action);
+
     /*!
      * \brief ぷよを瞬間移動で置く
      *
@@ -137,36 +241,191 @@ class GameSim : public std::enable_shared_from_this<GameSim> {
     PUMILA_DLL void put(const Action &action);
     /*!
      * \brief ぷよを目標位置まで動かして置くときはここにセットしてstep()を呼ぶ
+     *
+     * SoftPutPlannerの最短の入力列で動かす
+     * (回転・移動はsoft_put_intervalフレームに1回まで)
      */
     PUMILA_DLL void softPut(const Action &action);
 
+    /*
+     * 各フェーズは以下を持つ
+     * * step(): 処理を1周期進め、別のフェーズに移行する場合はその種類、
+     *   そうでなければnoneを返す
+     * * idleFrames(): 次のstep()から何回の間、タイマーが減るだけで何も起きないか
+     * * skip(n): step()をn回 (idleFrames()以下) 呼んだのと同じだけタイマーを進める
+     */
     struct GarbagePhase final : Phase {
         PUMILA_DLL explicit GarbagePhase(GameSim *sim);
-        PhaseEnum get() const override { return PhaseEnum::garbage; }
-        PUMILA_DLL std::unique_ptr<Phase> step() override;
+        static constexpr PhaseEnum get() { return PhaseEnum::garbage; }
+        PUMILA_DLL PhaseEnum step();
+        int idleFrames() const { return wait_t > 0 ? wait_t : 0; }
+        void skip(int n) {
+            assert(n <= idleFrames());
+            wait_t -= n;
+        }
         static constexpr int WAIT_T = 20;
         int wait_t;
     };
     struct FreePhase final : Phase {
         PUMILA_DLL explicit FreePhase(GameSim *sim);
-        PhaseEnum get() const override { return PhaseEnum::free; }
-        PUMILA_DLL std::unique_ptr<Phase> step() override;
+        static constexpr PhaseEnum get() { return PhaseEnum::free; }
+        PUMILA_DLL PhaseEnum step();
+        int idleFrames() const { return 0; }
+        void skip(int n) {
+            assert(n == 0 && "FreePhase cannot skip frames");
+            (void)n;
+        }
+        /*!
+         * \brief step()の落下部分: ppを1フレーム分落とし、
+         * 接地していればput_tを減らす
+         * \return 設置する場合true
+         */
+        PUMILA_DLL static bool fallPair(const FieldState3 &field, PuyoPair &pp,
+                                        int &put_t);
         static constexpr int PUT_T = 100;
         static constexpr double FALL_SPEED = 1.0;
         static constexpr double SOFT_SPEED = 25.0;
         int put_t;
+        /*!
+         * \brief quickDrop()されたかどうか
+         */
+        bool dropped = false;
     };
     struct FallPhase final : Phase {
         PUMILA_DLL explicit FallPhase(GameSim *sim);
-        PhaseEnum get() const override { return PhaseEnum::fall; }
-        PUMILA_DLL std::unique_ptr<Phase> step() override;
+        static constexpr PhaseEnum get() { return PhaseEnum::fall; }
+        PUMILA_DLL PhaseEnum step();
+        PUMILA_DLL int idleFrames() const;
+        PUMILA_DLL void skip(int n);
         static constexpr int FALL_T = 20;
         static constexpr int CHAIN_T = 30;
-        std::vector<int> chain_t;
+        /*!
+         * \brief current_chain番目の連鎖の残り時間
+         * (それ以前の連鎖は終わっていて、以降の連鎖はCHAIN_T + FALL_Tから)
+         */
+        int chain_t;
         std::size_t current_chain;
         int fall_wait_t;
-        FieldState3 display_field;
+        /*!
+         * \brief 表示用に1連鎖ずつ進めるfield (GarbageGroupには報告しない)
+         * (GameSim::headlessなら空)
+         *
+         * 進めるたびに新しいFieldSnapshotにするので、
+         * フェーズのコピー (snapshot()) では盤面をコピーしない
+         */
+        FieldSnapshot display_field;
     };
+
+    /*!
+     * \brief 現在のフェーズを (ヒープを使わず) variantで直接持つ
+     *
+     * `sim->phase->get()`, `sim->phase != nullptr` のように
+     * 以前のunique_ptr<Phase>と同じ書き方で使える
+     */
+    class PhaseHolder {
+        std::variant<std::monostate, FreePhase, FallPhase, GarbagePhase> state;
+
+      public:
+        PhaseHolder() = default;
+        PhaseHolder(std::nullptr_t) : PhaseHolder() {}
+
+        PhaseHolder *operator->() { return this; }
+        const PhaseHolder *operator->() const { return this; }
+        explicit operator bool() const { return state.index() != 0; }
+        bool operator==(std::nullptr_t) const { return !*this; }
+        bool operator!=(std::nullptr_t) const { return !!*this; }
+
+        /*!
+         * \brief 現在のフェーズの種類 (無ければnone)
+         */
+        Phase::PhaseEnum get() const {
+            switch (state.index()) {
+            case 1:
+                return FreePhase::get();
+            case 2:
+                return FallPhase::get();
+            case 3:
+                return GarbagePhase::get();
+            default:
+                return Phase::none;
+            }
+        }
+        /*!
+         * \brief 現在のフェーズがTならそのポインタ、そうでなければnullptr
+         */
+        template <typename T>
+        T *getIf() {
+            return std::get_if<T>(&state);
+        }
+        template <typename T>
+        const T *getIf() const {
+            return std::get_if<T>(&state);
+        }
+        /*!
+         * \brief kindのフェーズに移行する (古いフェーズは先に破棄される)
+         */
+        PUMILA_DLL void emplace(Phase::PhaseEnum kind, GameSim *sim);
+        void reset() { state = std::monostate{}; }
+
+        /*!
+         * \brief 現在のフェーズのstep()を呼び、必要なら次のフェーズに移行する
+         */
+        PUMILA_DLL void step();
+        PUMILA_DLL int idleFrames() const;
+        PUMILA_DLL void skip(int n);
+        /*!
+         * \brief 現在のフェーズの持ち主をsimに変える (コピーした後に使う)
+         */
+        PUMILA_DLL void rebind(GameSim *sim);
+    };
+    PhaseHolder phase;
+
+    /*!
+     * \brief snapshot()で保存したGameSimの状態
+     *
+     * field (おじゃまの参照を含む)、フェーズとタイマー、操作の状態は値で持ち、
+     * current_step、入力列、表示用の盤面は変更しないものとして共有する
+     * (GameSimは次に書き換える時にコピーする)。
+     * ヒープを確保しないので、先読みで何度も取ってよい
+     */
+    struct Snapshot {
+        std::optional<FieldState3> field;
+        SharedFieldState3::GarbageKeep garbage_keep;
+        /*!
+         * \brief garbage_keepの各GarbageGroupの (相殺した数, 降った数)
+         */
+        std::array<std::pair<std::size_t, std::size_t>,
+                   GarbageQueue::CAPACITY>
+            garbage_counts;
+        PhaseHolder phase;
+        std::shared_ptr<const StepResult> current_step;
+
+        std::optional<Action> soft_put_target;
+        std::shared_ptr<const SoftPutPlanner::Plan> soft_put_plan;
+        std::size_t soft_put_plan_pos = 0;
+        bool soft_put_planned = false;
+        int soft_put_cnt = 0;
+        int rot_fail = 0;
+        int rot_fail_count = 0;
+        bool is_over = false;
+        int step_count = 0;
+        int frame_count = 0;
+    };
+    /*!
+     * \brief 現在の状態を保存する (先読みで分岐するため)
+     *
+     * opponent, recorder, enable_garbage, soft_put_intervalは含まない。
+     * 先読み中はrecorderを外しておくこと
+     */
+    PUMILA_DLL Snapshot snapshot() const;
+    /*!
+     * \brief snapshot()の時点に戻す
+     *
+     * 自分に送られてきたGarbageGroupは相手と共有しているので、
+     * それらの相殺・落下した数も戻す。
+     * 対戦中は2人とも同じ時点のsnapshotに (同じスレッドで) 戻すこと
+     */
+    PUMILA_DLL void restore(const Snapshot &snapshot);
 };
 
 } // namespace PUMILA_NS
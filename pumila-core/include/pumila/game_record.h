@@ -0,0 +1,203 @@
+#pragma once
+#include "def.h"
+#include "action.h"
+#include "chain.h"
+#include "field3.h"
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace PUMILA_NS {
+/*!
+ * \brief 1人分のゲームの記録
+ *
+ * 盤面は持たず、seedと各ターンのactionと送られてきたおじゃまの数だけで
+ * GameReplayerが盤面を再現できる。
+ *
+ * バイナリ形式 (write(), read(), GameRecordWriter):
+ * * ヘッダ: 'P', 'R', VERSION, seed (varint)
+ * * 各ターン: 1バイト目の下位5bitがaction、
+ *   bit5, 6, 7が立っていれば chains, garbage_send, garbage_recv
+ *   (varint) が続く。
+ *   その後に前のターンとのframesの差 (zigzag varint)
+ * * 終端: END (1バイト)
+ *
+ * 連鎖もおじゃまもないターンは2バイトになる
+ */
+struct GameRecord {
+    static constexpr std::uint8_t VERSION = 1;
+    static constexpr std::uint8_t END = 0xff;
+
+    struct Turn {
+        /*!
+         * \brief actionsのindex
+         */
+        std::uint8_t action = 0;
+        /*!
+         * \brief このターンのFreePhaseの開始から次のFreePhaseの開始まで
+         */
+        int frames = 0;
+        std::size_t chains = 0;
+        /*!
+         * \brief 連鎖で生成したおじゃま (相殺前)
+         */
+        std::size_t garbage_send = 0;
+        /*!
+         * \brief 前のターンのおじゃまが降った後から
+         * このターンの相殺の前までに送られてきたおじゃま
+         */
+        std::size_t garbage_recv = 0;
+
+        bool operator==(const Turn &other) const {
+            return action == other.action && frames == other.frames &&
+                   chains == other.chains &&
+                   garbage_send == other.garbage_send &&
+                   garbage_recv == other.garbage_recv;
+        }
+        bool operator!=(const Turn &other) const { return !(*this == other); }
+    };
+
+    std::uint64_t seed = 0;
+    std::vector<Turn> turns;
+
+    PUMILA_DLL void write(std::ostream &os) const;
+    /*!
+     * \brief write()された記録を1つ読む
+     * \return ストリームが記録の前で終わっていればnullopt
+     *
+     * 形式が壊れているか途中で終わっていたら std::runtime_error を投げる
+     */
+    PUMILA_DLL static std::optional<GameRecord> read(std::istream &is);
+};
+
+/*!
+ * \brief GameSimの各ターンをGameRecordの形式でストリームに書き出す
+ *
+ * GameSim::recorderにセットすると、次のGameSim::reset()からゲームごとに
+ * 記録を書く。ターンは次のFreePhaseが始まった時点で書き出され、
+ * ゲームオーバーになるか次のreset()で終端が書かれる。
+ * 途中でやめる場合はfinish()を呼ぶ (置いた後まだ終わっていないターンは捨てる)。
+ *
+ * ロックしないので、1つのGameSimの中でのみ使うこと
+ */
+class GameRecordWriter {
+    std::unique_ptr<std::ostream> own_os;
+    std::ostream *os;
+
+    bool recording = false;
+    std::optional<GameRecord::Turn> pending;
+    int turn_start = 0;
+    int last_frames = 0;
+    /*!
+     * \brief 前のターンでおじゃまが降った後に残っていたおじゃま
+     */
+    std::size_t garbage_ready = 0;
+    std::size_t game_num = 0, turn_num = 0;
+
+  public:
+    /*!
+     * \brief osに書く (osはこのwriterより長く残すこと)
+     */
+    PUMILA_DLL explicit GameRecordWriter(std::ostream &os);
+    /*!
+     * \brief 内部のバッファに書く (data()で取り出す)
+     */
+    PUMILA_DLL GameRecordWriter();
+    PUMILA_DLL ~GameRecordWriter();
+    GameRecordWriter(const GameRecordWriter &) = delete;
+    GameRecordWriter &operator=(const GameRecordWriter &) = delete;
+
+    /*!
+     * \brief 新しいゲームを始める (記録中のゲームがあればfinish()する)
+     */
+    PUMILA_DLL void begin(std::uint64_t seed, int frame);
+    /*!
+     * \brief ぷよを置いた時
+     */
+    PUMILA_DLL void put(const Action &action);
+    /*!
+     * \brief GarbagePhaseの開始時
+     * \param garbage_send 連鎖で生成したおじゃま (相殺前)
+     * \param ready_before 相殺前に自分に降る予定だったおじゃま
+     * \param ready_after おじゃまが降った後に残っているおじゃま
+     */
+    PUMILA_DLL void garbage(std::size_t chains, std::size_t garbage_send,
+                            std::size_t ready_before, std::size_t ready_after);
+    /*!
+     * \brief 次のFreePhaseの開始時: 置いたターンがあれば書き出す
+     */
+    PUMILA_DLL void endTurn(int frame);
+    /*!
+     * \brief 記録中のゲームの終端を書く
+     */
+    PUMILA_DLL void finish();
+
+    bool isRecording() const { return recording; }
+    /*!
+     * \brief 書き終えたゲームの数
+     */
+    std::size_t games() const { return game_num; }
+    /*!
+     * \brief 書き出したターンの数 (全ゲームの合計)
+     */
+    std::size_t turns() const { return turn_num; }
+    /*!
+     * \brief 内部のバッファに書いた内容
+     * (コンストラクタでストリームを渡した場合は空)
+     */
+    PUMILA_DLL std::string data() const;
+};
+
+/*!
+ * \brief GameRecordからフレームを進めずにターンごとに盤面を再現する
+ *
+ * GameSimと同じ順にputNext, fall, deleteChainRecurse, calcGarbage,
+ * (送られてきたおじゃまを追加して) cancelGarbage, putGarbageをする。
+ * 各ターンの後のfield()はGameSimのそのターンのfield_afterと一致する
+ */
+class GameReplayer {
+    GameRecord rec;
+    FieldState3 current;
+    std::size_t turn_index;
+    int frame_num;
+
+  public:
+    PUMILA_DLL explicit GameReplayer(GameRecord record);
+
+    const GameRecord &record() const { return rec; }
+    /*!
+     * \brief 現在 (次のターンの開始時) の盤面
+     */
+    const FieldState3 &field() const { return current; }
+    /*!
+     * \brief 再生したターンの数
+     */
+    std::size_t turn() const { return turn_index; }
+    /*!
+     * \brief 次のターンの開始時刻 (GameSim::frame_count)
+     */
+    int frame() const { return frame_num; }
+    bool done() const { return turn_index >= rec.turns.size(); }
+
+    /*!
+     * \brief 最初のターンの前に戻る
+     */
+    PUMILA_DLL void reset();
+    /*!
+     * \brief 次のターンを再生する
+     * \return そのターンの連鎖
+     *
+     * 連鎖数か生成したおじゃまが記録と違えば std::runtime_error を投げる
+     */
+    PUMILA_DLL std::vector<Chain> step();
+    /*!
+     * \brief turnターン再生した状態にする
+     * (前に戻る場合は最初から再生し直す)
+     */
+    PUMILA_DLL void seek(std::size_t turn);
+};
+} // namespace PUMILA_NS
@@ -1,17 +1,24 @@
 #pragma once
 #include "def.h"
+#include <array>
+#include <atomic>
 #include <cassert>
-#include <mutex>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 
 namespace PUMILA_NS {
 /*!
  * \brief 1回の連鎖で送るおじゃまのまとまり
+ *
+ * 送った側 (StepResult::garbage_send) と受け取った側の両方から参照される。
+ * 書き込む(相殺する・降らせる)のは受け取った側のフィールドだけで、
+ * 送った側は読むだけなのでカウンタはatomicでロックはしない
  */
 class GarbageGroup {
-    mutable std::recursive_mutex mtx;
     std::size_t garbage_num;
-    std::size_t cancelled_num;
-    std::size_t fell_num;
+    std::atomic<std::size_t> cancelled_num;
+    std::atomic<std::size_t> fell_num;
 
   public:
     explicit GarbageGroup(std::size_t garbage_num = 0)
@@ -23,27 +30,23 @@ class GarbageGroup {
     /*!
      * \brief もとのおじゃまの数
      */
-    std::size_t garbageNum() const {
-        std::lock_guard lock(mtx);
-        return garbage_num;
-    }
+    std::size_t garbageNum() const { return garbage_num; }
     /*!
      * \brief まだ未確定のおじゃまの数
      */
     std::size_t restGarbageNum() const {
-        std::lock_guard lock(mtx);
-        assert(garbageNum() >= (cancelledNum() + fellNum()));
-        return garbageNum() - cancelledNum() - fellNum();
+        std::size_t cancelled = cancelledNum(), fell = fellNum();
+        assert(garbage_num >= cancelled + fell);
+        return garbage_num - cancelled - fell;
     }
     /*!
      * \brief 相殺する
      * \return 相殺量
      */
     std::size_t cancel(std::size_t cancel) {
-        std::lock_guard lock(mtx);
-        std::size_t cancel_actual =
-            cancel > restGarbageNum() ? restGarbageNum() : cancel;
-        cancelled_num += cancel_actual;
+        std::size_t rest = restGarbageNum();
+        std::size_t cancel_actual = cancel > rest ? rest : cancel;
+        cancelled_num.fetch_add(cancel_actual, std::memory_order_release);
         return cancel_actual;
     }
     /*!
@@ -51,10 +54,9 @@ class GarbageGroup {
      * \return 降らせるぷよの量
      */
     std::size_t fall(std::size_t fall_max) {
-        std::lock_guard lock(mtx);
-        std::size_t fall_actual =
-            fall_max > restGarbageNum() ? restGarbageNum() : fall_max;
-        fell_num += fall_actual;
+        std::size_t rest = restGarbageNum();
+        std::size_t fall_actual = fall_max > rest ? rest : fall_max;
+        fell_num.fetch_add(fall_actual, std::memory_order_release);
         return fall_actual;
     }
     /*!
@@ -62,17 +64,160 @@ class GarbageGroup {
      */
     std::size_t fallAll() { return fall(restGarbageNum()); }
 
-    bool done() const {
-        std::lock_guard lock(mtx);
-        return restGarbageNum() == 0;
+    /*!
+     * \brief 相殺・落下した数を上書きする (GameSim::restore()用)
+     */
+    void setCounts(std::size_t cancelled, std::size_t fell) {
+        assert(garbage_num >= cancelled + fell);
+        cancelled_num.store(cancelled, std::memory_order_release);
+        fell_num.store(fell, std::memory_order_release);
     }
+
+    bool done() const { return restGarbageNum() == 0; }
     std::size_t cancelledNum() const {
-        std::lock_guard lock(mtx);
-        return cancelled_num;
+        return cancelled_num.load(std::memory_order_acquire);
     }
     std::size_t fellNum() const {
-        std::lock_guard lock(mtx);
-        return fell_num;
+        return fell_num.load(std::memory_order_acquire);
+    }
+};
+
+/*!
+ * \brief フィールドに降る予定のおじゃまの列 (固定長のリングバッファ)
+ *
+ * 各要素は残りの数と、相殺・落下を報告するGarbageGroupへのポインタのみ持つ。
+ * GarbageGroupの寿命は持ち主 (GameSimなど) が管理する。
+ * コピーはmemcpyと同等でヒープも参照カウントも使わない
+ */
+class GarbageQueue {
+  public:
+    /*!
+     * \brief 同時に待っていられるおじゃまのまとまりの数
+     *
+     * 1ターンに最大30個降るので、普通は数ターン分しかたまらない
+     */
+    static constexpr std::size_t CAPACITY = 32;
+
+    struct Entry {
+        /*!
+         * \brief 報告先 (nullptrなら報告しない)
+         */
+        GarbageGroup *group;
+        /*!
+         * \brief まだ未確定のおじゃまの数
+         */
+        std::size_t rest;
+    };
+
+  private:
+    std::array<Entry, CAPACITY> entries;
+    std::uint32_t head, num;
+    std::size_t total;
+
+    Entry &front() { return entries[head]; }
+    void popFront() {
+        head = (head + 1) % CAPACITY;
+        num--;
+    }
+
+  public:
+    GarbageQueue() : entries(), head(0), num(0), total(0) {}
+
+    std::size_t size() const { return num; }
+    bool empty() const { return num == 0; }
+    const Entry &operator[](std::size_t i) const {
+        assert(i < num && "out of range in GarbageQueue");
+        return entries[(head + i) % CAPACITY];
+    }
+    /*!
+     * \brief 残りのおじゃまの合計
+     */
+    std::size_t totalNum() const { return total; }
+
+    /*!
+     * \brief groupの未確定のおじゃまを末尾に追加
+     */
+    void push(GarbageGroup *group) {
+        assert(group);
+        push(group, group->restGarbageNum());
+    }
+    /*!
+     * \brief rest個のおじゃまを末尾に追加 (groupはnullptrも可)
+     *
+     * 末尾と同じgroupならそこにまとめる。
+     * CAPACITY個たまっていて追加できなければ std::length_error を投げる
+     * (キューは変更しない)
+     */
+    void push(GarbageGroup *group, std::size_t rest) {
+        if (rest == 0) {
+            return;
+        }
+        if (num > 0) {
+            Entry &tail = entries[(head + num - 1) % CAPACITY];
+            if (tail.group == group) {
+                tail.rest += rest;
+                total += rest;
+                return;
+            }
+        }
+        if (num >= CAPACITY) {
+            throw std::length_error("GarbageQueue overflow");
+        }
+        entries[(head + num) % CAPACITY] = {group, rest};
+        num++;
+        total += rest;
+    }
+    /*!
+     * \brief 先頭から相殺する
+     * \return 相殺した数
+     */
+    std::size_t cancel(std::size_t n) {
+        std::size_t done = 0;
+        while (done < n && !empty()) {
+            Entry &e = front();
+            std::size_t c = n - done < e.rest ? n - done : e.rest;
+            if (e.group) {
+                e.group->cancel(c);
+            }
+            e.rest -= c;
+            done += c;
+            if (e.rest == 0) {
+                popFront();
+            }
+        }
+        total -= done;
+        return done;
+    }
+    /*!
+     * \brief 先頭から降らせる
+     * \return 降らせた数
+     */
+    std::size_t fall(std::size_t n) {
+        std::size_t done = 0;
+        while (done < n && !empty()) {
+            Entry &e = front();
+            std::size_t f = n - done < e.rest ? n - done : e.rest;
+            if (e.group) {
+                e.group->fall(f);
+            }
+            e.rest -= f;
+            done += f;
+            if (e.rest == 0) {
+                popFront();
+            }
+        }
+        total -= done;
+        return done;
+    }
+    /*!
+     * \brief GarbageGroupへの報告をやめる (残りの数は保つ)
+     *
+     * 寿命の管理されていないコピー (スナップショット) に使う
+     */
+    void detach() {
+        for (auto &e : entries) {
+            e.group = nullptr;
+        }
     }
 };
 
@@ -3,6 +3,10 @@
 #include "../field3.h"
 #include "../step.h"
 #include "../matrix.h"
+#include "../sharded_cache.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
 
 namespace PUMILA_NS {
 struct Pumila14 {
@@ -13,7 +17,107 @@ struct Pumila14 {
     };
     static constexpr std::size_t FEATURE_NUM =
         sizeof(InFeature) / sizeof(double);
+
+    /*!
+     * \brief InFeatureの1行を圧縮したもの
+     *
+     * InFeatureはほとんど0のdoubleが600個以上あるので、
+     * FeatureCacheにはこちらを保存する
+     */
+    struct FeatureRow {
+        static constexpr std::size_t CELL_NUM =
+            FieldState3::WIDTH * FieldState3::HEIGHT;
+        /*!
+         * \brief 各マス (y * WIDTH + x) の色 (red→1 〜 yellow→4, それ以外0)
+         */
+        std::array<std::uint8_t, CELL_NUM> colors;
+        /*!
+         * \brief 各マスを消したときの連鎖数
+         */
+        std::array<std::uint8_t, CELL_NUM> chains;
+        std::uint8_t chain_num;
+        std::array<int, MAX_CHAIN_NUM> scores;
+
+        /*!
+         * \brief fieldにactions[a]で置いた結果を計算する
+         */
+        PUMILA_DLL static FeatureRow calc(const FieldState3 &field, int a);
+        /*!
+         * \brief featに書き込む (featは0で初期化されていること)
+         */
+        PUMILA_DLL void expand(InFeature *feat) const;
+    };
+
+    /*!
+     * \brief (盤面, 操作中のぷよの色, action) → FeatureRow のキャッシュ
+     *
+     * リプレイから同じ状態を何度もcalcActionするのでその分を省く。
+     * ChainAllCacheと同じくShardedCacheを使い、キーはすべて保存して比較する
+     */
+    class FeatureCache {
+        struct Key {
+            PuyoBoard board;
+            Puyo bottom = Puyo::none, top = Puyo::none;
+            int action = -1;
+
+            Key() = default;
+            Key(const FieldState3 &field, int a);
+            bool operator==(const Key &other) const {
+                return action == other.action && bottom == other.bottom &&
+                       top == other.top && board == other.board;
+            }
+            std::uint64_t hash() const;
+        };
+        ShardedCache<Key, FeatureRow> cache;
+
+      public:
+        /*!
+         * \param capacity 保持する行の数
+         */
+        PUMILA_DLL explicit FeatureCache(std::size_t capacity = 1 << 14);
+        FeatureCache(const FeatureCache &) = delete;
+        FeatureCache &operator=(const FeatureCache &) = delete;
+
+        /*!
+         * \brief キャッシュにあればrowに書き込んでtrue
+         */
+        PUMILA_DLL bool find(const FieldState3 &field, int a,
+                             FeatureRow &row);
+        PUMILA_DLL void store(const FieldState3 &field, int a,
+                              const FeatureRow &row);
+
+        std::size_t capacity() const { return cache.capacity(); }
+        std::size_t hits() const { return cache.hits(); }
+        std::size_t misses() const { return cache.misses(); }
+        void clear() { cache.clear(); }
+    };
+    /*!
+     * \brief calcAction()が使うキャッシュ
+     */
+    PUMILA_DLL static FeatureCache &featureCache();
+
+    /*!
+     * \brief field_beforeから各actionで置いた結果の特徴量
+     *
+     * ACTIONS_NUM行で、置けないaction (legalActions()) の行は0。
+     * 同じ盤面になるaction (FieldState3::placementGroups()) は
+     * 1回だけ計算して行をコピーする
+     */
     PUMILA_DLL static Matrix calcAction(const StepResult &result);
+    /*!
+     * \brief field_beforeで置けるactionsのbitmask
+     */
+    static std::uint32_t legalActions(const StepResult &result) {
+        return result.field_before->legalActions();
+    }
+    /*!
+     * \brief calcAction()と同じ特徴量をスレッドプールを使わずに計算する
+     *
+     * rowsはACTIONS_NUM行分あり0で初期化されていること。
+     * スレッドプールのタスクの中から呼ぶ用
+     */
+    PUMILA_DLL static void calcActionTo(const FieldState3 &field,
+                                        InFeature *rows);
     PUMILA_DLL static Matrix rotateColor(const Matrix &in);
     PUMILA_DLL static double reward(const StepResult &result);
 };
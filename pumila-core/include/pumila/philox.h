@@ -0,0 +1,96 @@
+#pragma once
+#include "def.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace PUMILA_NS {
+/*!
+ * \brief Philox4x32-10 (counter-based RNG)
+ *
+ * key と counter から乱数のブロックを直接計算するので内部状態を持たない。
+ * 同じkey, counterなら必ず同じ値になり、スレッド間で共有するものもない
+ */
+struct Philox {
+    using Block = std::array<std::uint32_t, 4>;
+
+    /*!
+     * \brief key, counterに対応する乱数4個
+     */
+    static constexpr Block block(std::uint64_t key, std::uint64_t counter_lo,
+                                 std::uint64_t counter_hi = 0) {
+        Block c = {static_cast<std::uint32_t>(counter_lo),
+                   static_cast<std::uint32_t>(counter_lo >> 32),
+                   static_cast<std::uint32_t>(counter_hi),
+                   static_cast<std::uint32_t>(counter_hi >> 32)};
+        std::uint32_t k0 = static_cast<std::uint32_t>(key);
+        std::uint32_t k1 = static_cast<std::uint32_t>(key >> 32);
+        for (int r = 0; r < 10; r++) {
+            std::uint64_t p0 = std::uint64_t{0xD2511F53} * c[0];
+            std::uint64_t p1 = std::uint64_t{0xCD9E8D57} * c[2];
+            c = {static_cast<std::uint32_t>(p1 >> 32) ^ c[1] ^ k0,
+                 static_cast<std::uint32_t>(p1),
+                 static_cast<std::uint32_t>(p0 >> 32) ^ c[3] ^ k1,
+                 static_cast<std::uint32_t>(p0)};
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+        }
+        return c;
+    }
+};
+
+/*!
+ * \brief Philoxを順に使う乱数エンジン (UniformRandomBitGenerator)
+ *
+ * key, stream と何個目かだけを持つのでコピーが安く、
+ * 同じkey, streamから作れば同じ列を再現できる
+ */
+class PhiloxEngine {
+    std::uint64_t key;
+    std::uint64_t stream;
+    std::uint64_t counter;
+    Philox::Block buf;
+    std::size_t buf_index;
+
+  public:
+    using result_type = std::uint32_t;
+
+    constexpr PhiloxEngine(std::uint64_t key, std::uint64_t stream = 0)
+        : key(key), stream(stream), counter(0), buf(), buf_index(4) {}
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() {
+        return std::numeric_limits<result_type>::max();
+    }
+    constexpr result_type operator()() {
+        if (buf_index == 4) {
+            buf = Philox::block(key, counter++, stream);
+            buf_index = 0;
+        }
+        return buf[buf_index++];
+    }
+    /*!
+     * \brief 0以上n未満の整数
+     *
+     * std::uniform_int_distributionは実装依存なので使わない
+     * (乗算で範囲を縮める、nが小さいので偏りは無視できる)
+     */
+    constexpr std::uint32_t uniform(std::uint32_t n) {
+        return static_cast<std::uint32_t>(
+            (static_cast<std::uint64_t>((*this)()) * n) >> 32);
+    }
+    /*!
+     * \brief [first, last) をシャッフルする (Fisher-Yates)
+     */
+    template <typename It>
+    constexpr void shuffle(It first, It last) {
+        for (auto n = last - first; n > 1; n--) {
+            auto j = uniform(static_cast<std::uint32_t>(n));
+            auto tmp = first[n - 1];
+            first[n - 1] = first[j];
+            first[j] = tmp;
+        }
+    }
+};
+} // namespace PUMILA_NS
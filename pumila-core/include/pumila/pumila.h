@@ -1,13 +1,26 @@
 #pragma once
 #include "action.h"
+#include "bitboard.h"
+#include "static_vector.h"
+#include "philox.h"
 #include "garbage.h"
 #include "chain.h"
+#include "board.h"
+#include "tsumo.h"
+#include "sharded_cache.h"
+#include "chain_all_cache.h"
 #include "field3.h"
+#include "field_snapshot.h"
+#include "shared_field3.h"
 #include "step.h"
+#include "soft_put_planner.h"
+#include "game_record.h"
 #include "game.h"
+#include "arena.h"
 
 #include "models/common.h"
 #include "models/pumila14.h"
+#include "vec_game.h"
 
 #ifdef _MSC_VER
 #ifdef  _DEBUG
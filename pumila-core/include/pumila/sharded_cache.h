@@ -0,0 +1,99 @@
+#pragma once
+#include "def.h"
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace PUMILA_NS {
+/*!
+ * \brief 複数スレッドから使う、容量固定のキャッシュ
+ *
+ * * hashで決まる1つのスロットにKeyとValueを持ち、衝突したら上書きする
+ * * ロックはSHARD_NUM個のshardに分けてある
+ * * キーはすべて保存して比較するので、hashが一致してもキーが違えばミス
+ *
+ * 値の計算はロックの外でするので、find()でミスしたら計算してstore()する
+ */
+template <typename Key, typename Value>
+class ShardedCache {
+    struct Entry {
+        Key key{};
+        Value value{};
+        bool valid = false;
+    };
+    static constexpr std::size_t SHARD_NUM = 64;
+
+    std::vector<Entry> entries;
+    std::array<std::mutex, SHARD_NUM> mtx;
+    std::atomic<std::size_t> hit_num, miss_num;
+
+    std::size_t index(std::uint64_t hash) const {
+        return static_cast<std::size_t>(hash % entries.size());
+    }
+    std::mutex &shard(std::size_t i) { return mtx[i % SHARD_NUM]; }
+
+  public:
+    /*!
+     * \param capacity 保持するエントリの数
+     */
+    explicit ShardedCache(std::size_t capacity)
+        : entries(capacity), mtx(), hit_num(0), miss_num(0) {
+        assert(capacity > 0 && "ShardedCache capacity must be positive");
+    }
+    ShardedCache(const ShardedCache &) = delete;
+    ShardedCache &operator=(const ShardedCache &) = delete;
+
+    /*!
+     * \brief keyがあればvalueにコピーしてtrue (ヒットとミスを数える)
+     */
+    bool find(std::uint64_t hash, const Key &key, Value &value) {
+        std::size_t i = index(hash);
+        {
+            std::lock_guard lock(shard(i));
+            const Entry &entry = entries[i];
+            if (entry.valid && entry.key == key) {
+                value = entry.value;
+                hit_num.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+        miss_num.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    /*!
+     * \brief hashのスロットをkey, valueで上書きする
+     */
+    void store(std::uint64_t hash, const Key &key, const Value &value) {
+        std::size_t i = index(hash);
+        std::lock_guard lock(shard(i));
+        Entry &entry = entries[i];
+        entry.key = key;
+        entry.value = value;
+        entry.valid = true;
+    }
+
+    std::size_t capacity() const { return entries.size(); }
+    std::size_t hits() const {
+        return hit_num.load(std::memory_order_relaxed);
+    }
+    std::size_t misses() const {
+        return miss_num.load(std::memory_order_relaxed);
+    }
+    /*!
+     * \brief すべて無効にし、ヒット・ミスの数を0にする
+     * (値も捨てるので、共有しているポインタなどは解放される)
+     */
+    void clear() {
+        for (std::size_t i = 0; i < entries.size(); i++) {
+            std::lock_guard lock(shard(i));
+            entries[i] = Entry{};
+        }
+        hit_num.store(0, std::memory_order_relaxed);
+        miss_num.store(0, std::memory_order_relaxed);
+    }
+};
+} // namespace PUMILA_NS
@@ -0,0 +1,156 @@
+#pragma once
+#include "def.h"
+#include "field3.h"
+#include "field_snapshot.h"
+#include "garbage.h"
+#include "static_vector.h"
+#include <algorithm>
+#include <cassert>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+
+namespace PUMILA_NS {
+/*!
+ * \brief 複数スレッドからアクセスされるFieldState3
+ *
+ * GameSimのfieldは相手のGameSimからもおじゃまの追加やコピーで
+ * アクセスされるので、これで包む。
+ * `shared->get(x, y)` のように使うと式の間だけロックする。
+ * 続けて何度もアクセスする場合はlock()の戻り値を保持する。
+ *
+ * 2つのSharedFieldState3のロックを同時に保持しないこと
+ *
+ * FieldState3はおじゃまをポインタでしか持たないので、
+ * 降り終わるまでのGarbageGroupはこちらで保持する (addGarbage())
+ */
+class SharedFieldState3 {
+  public:
+    /*!
+     * \brief 降り終わるまで保持するGarbageGroup
+     *
+     * 降り終わったものはaddGarbage()で除くので、残りはどれも
+     * fieldのGarbageQueueにあり、その容量を超えない
+     */
+    using GarbageKeep =
+        StaticVector<std::shared_ptr<GarbageGroup>, GarbageQueue::CAPACITY>;
+
+  private:
+    mutable std::recursive_mutex mtx;
+    std::optional<FieldState3> field;
+    GarbageKeep garbage_keep;
+
+  public:
+    /*!
+     * \brief ロックを保持している間fieldにアクセスできる
+     */
+    template <typename T>
+    class Locked {
+        using Optional =
+            std::conditional_t<std::is_const_v<T>,
+                               const std::optional<FieldState3>,
+                               std::optional<FieldState3>>;
+        std::unique_lock<std::recursive_mutex> lock;
+        T *field;
+
+      public:
+        /*!
+         * \brief fieldはemplace()やload()で変わるので、
+         * ロックを取ってから (lockの初期化の後に) 読む
+         */
+        Locked(std::recursive_mutex &mtx, Optional &field)
+            : lock(mtx), field(field ? &*field : nullptr) {}
+        T *operator->() const {
+            assert(field && "SharedFieldState3 has no value");
+            return field;
+        }
+        T &operator*() const { return *operator->(); }
+    };
+
+    SharedFieldState3() = default;
+    SharedFieldState3(const SharedFieldState3 &) = delete;
+    SharedFieldState3 &operator=(const SharedFieldState3 &) = delete;
+
+    Locked<FieldState3> lock() {
+        return Locked<FieldState3>(mtx, field);
+    }
+    Locked<const FieldState3> lock() const {
+        return Locked<const FieldState3>(mtx, field);
+    }
+    Locked<FieldState3> operator->() { return lock(); }
+    Locked<const FieldState3> operator->() const { return lock(); }
+
+    bool has_value() const {
+        std::lock_guard lock(mtx);
+        return field.has_value();
+    }
+    /*!
+     * \brief ロックしてコピーを返す
+     *
+     * コピーはGarbageGroupに報告しない (FieldState3::detached())
+     */
+    std::optional<FieldState3> copy() const {
+        std::lock_guard lock(mtx);
+        if (!field) {
+            return std::nullopt;
+        }
+        return field->detached();
+    }
+    /*!
+     * \brief ロックしてスナップショットを返す (値が無ければ空)
+     */
+    FieldSnapshot snapshot() const {
+        std::lock_guard lock(mtx);
+        return field ? FieldSnapshot(*field) : FieldSnapshot();
+    }
+    /*!
+     * \brief ロックしてfieldと保持しているおじゃまをコピーする
+     * (fieldはGarbageGroupに報告したまま)
+     */
+    void save(std::optional<FieldState3> &field_out,
+              GarbageKeep &garbage_out) const {
+        std::lock_guard lock(mtx);
+        field_out = field;
+        garbage_out = garbage_keep;
+    }
+    /*!
+     * \brief save()した状態に戻す
+     */
+    void load(const std::optional<FieldState3> &field_in,
+              const GarbageKeep &garbage_in) {
+        std::lock_guard lock(mtx);
+        field = field_in;
+        garbage_keep = garbage_in;
+    }
+    template <typename... Args>
+    void emplace(Args &&...args) {
+        std::lock_guard lock(mtx);
+        field.emplace(std::forward<Args>(args)...);
+        garbage_keep.clear();
+    }
+    /*!
+     * \brief fieldにおじゃまを追加し、降り終わるまでgarbageを保持する
+     */
+    void addGarbage(const std::shared_ptr<GarbageGroup> &garbage) {
+        std::lock_guard lock(mtx);
+        assert(field && "SharedFieldState3 has no value");
+        if (!garbage) {
+            return;
+        }
+        auto kept =
+            std::remove_if(garbage_keep.begin(), garbage_keep.end(),
+                           [](const auto &g) { return g->done(); });
+        while (garbage_keep.end() != kept) {
+            garbage_keep.pop_back();
+        }
+        // 溢れた場合はここで例外になるので、garbage_keepは変えない
+        field->addGarbage(garbage);
+        if (std::find(garbage_keep.begin(), garbage_keep.end(), garbage) ==
+            garbage_keep.end()) {
+            garbage_keep.push_back(garbage);
+        }
+    }
+};
+
+} // namespace PUMILA_NS
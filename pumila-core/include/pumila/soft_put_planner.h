@@ -0,0 +1,119 @@
+#pragma once
+#include "def.h"
+#include "action.h"
+#include "field3.h"
+#include "sharded_cache.h"
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <vector>
+
+namespace PUMILA_NS {
+/*!
+ * \brief GameSim::softPut()の目標まで最短フレームで置く入力列を探す
+ *
+ * (x, rot, y, put_t, 次に回転・移動できるまでのフレーム数,
+ * GameSim::rot_fail, rot_fail_count) を状態とし、
+ * 1フレームを1手としてA* (置くまでの残りフレーム数の下限を使う) で探す。
+ * 1フレームの入力はGameSim::step()と同じく
+ * 回転・移動 (soft_put_interval フレームに1回まで) とsoftDropで、
+ * 判定はGameSim::applyRotPair(), tryMovePair(), FreePhase::fallPair()を使う。
+ * (回転の失敗も入力になり、次の同じ向きの回転がクイックターンになる)
+ *
+ * 操作中は盤面に浮いたぷよがないので当たり判定は各列の高さだけで決まり、
+ * 結果は高さと開始状態ごとにShardedCacheにキャッシュする
+ */
+class SoftPutPlanner {
+  public:
+    /*!
+     * \brief yを整数で扱うための1マスあたりの単位 (1フレームの自然落下分)
+     */
+    static constexpr int Y_TICKS = 60;
+
+    /*!
+     * \brief 1フレーム分の入力と、その後のぷよの状態
+     */
+    struct Frame {
+        /*!
+         * \brief 回転 (右に何回, -1〜1)
+         */
+        std::int8_t rot = 0;
+        /*!
+         * \brief 移動 (-1〜1)
+         */
+        std::int8_t dx = 0;
+        bool soft = false;
+
+        int x = 0;
+        Action::Rotation rotation = Action::Rotation::vertical;
+        /*!
+         * \brief round(y * Y_TICKS)
+         */
+        int y_ticks = 0;
+        int put_t = 0;
+        int rot_fail = 0;
+        int rot_fail_count = 0;
+
+        /*!
+         * \brief 入力後 (落下処理の後) の状態がこのフレームの予定通りか
+         */
+        bool matches(const PuyoPair &pp, int put_t, int rot_fail,
+                     int rot_fail_count) const {
+            return pp.x == x && pp.rot == rotation &&
+                   std::lround(pp.y * Y_TICKS) == y_ticks &&
+                   put_t == this->put_t && rot_fail == this->rot_fail &&
+                   rot_fail_count == this->rot_fail_count;
+        }
+    };
+    using Plan = std::vector<Frame>;
+
+  private:
+    ShardedCache<std::array<std::uint64_t, 2>, std::shared_ptr<const Plan>>
+        cache;
+
+  public:
+    /*!
+     * \brief 最後のフレームで目標の位置に置かれる最短の入力列を探す
+     * \param pp 現在の操作中のぷよ
+     * \param put_t FreePhase::put_t
+     * \param cooldown 何フレーム後から回転・移動できるか
+     * \param rot_fail, rot_fail_count GameSim::rot_fail, rot_fail_count
+     * \param interval 回転・移動の間隔
+     * \return 目標の位置に置けない場合nullopt
+     */
+    PUMILA_DLL static std::optional<Plan>
+    search(const FieldState3 &field, const PuyoPair &pp, int put_t,
+           int cooldown, int rot_fail, int rot_fail_count,
+           const Action &target, int interval);
+
+    /*!
+     * \param capacity 保持する入力列の数
+     */
+    PUMILA_DLL explicit SoftPutPlanner(std::size_t capacity = 1 << 12);
+    SoftPutPlanner(const SoftPutPlanner &) = delete;
+    SoftPutPlanner &operator=(const SoftPutPlanner &) = delete;
+
+    /*!
+     * \brief search()の結果をキャッシュから返す (なければ探して保存する)
+     *
+     * 入力列は変更しないので、キャッシュと呼び出し元で共有する
+     * \return 目標の位置に置けない場合nullptr
+     */
+    PUMILA_DLL std::shared_ptr<const Plan>
+    plan(const FieldState3 &field, const PuyoPair &pp, int put_t, int cooldown,
+         int rot_fail, int rot_fail_count, const Action &target, int interval);
+
+    std::size_t capacity() const { return cache.capacity(); }
+    std::size_t hits() const { return cache.hits(); }
+    std::size_t misses() const { return cache.misses(); }
+    void clear() { cache.clear(); }
+
+    /*!
+     * \brief GameSimが使うキャッシュ
+     */
+    PUMILA_DLL static SoftPutPlanner &shared();
+};
+} // namespace PUMILA_NS
@@ -0,0 +1,123 @@
+#pragma once
+#include "def.h"
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <initializer_list>
+#include <new>
+#include <utility>
+
+namespace PUMILA_NS {
+/*!
+ * \brief 最大N個の要素をヒープを使わずに持つvector
+ *
+ * 盤面のマス数などから要素数の上限が決まっているものに使う。
+ * 上限を超えてpushするとassertで落ちる
+ */
+template <typename T, std::size_t N>
+class StaticVector {
+    alignas(T) unsigned char storage[sizeof(T) * N];
+    std::size_t num = 0;
+
+  public:
+    using value_type = T;
+    using iterator = T *;
+    using const_iterator = const T *;
+
+    StaticVector() {}
+    StaticVector(std::initializer_list<T> init) {
+        for (const auto &v : init) {
+            push_back(v);
+        }
+    }
+    template <typename It>
+    StaticVector(It first, It last) {
+        for (; first != last; ++first) {
+            push_back(*first);
+        }
+    }
+    StaticVector(const StaticVector &other) {
+        for (const auto &v : other) {
+            push_back(v);
+        }
+    }
+    StaticVector(StaticVector &&other) {
+        for (auto &v : other) {
+            push_back(std::move(v));
+        }
+    }
+    StaticVector &operator=(const StaticVector &other) {
+        if (this != &other) {
+            clear();
+            for (const auto &v : other) {
+                push_back(v);
+            }
+        }
+        return *this;
+    }
+    StaticVector &operator=(StaticVector &&other) {
+        if (this != &other) {
+            clear();
+            for (auto &v : other) {
+                push_back(std::move(v));
+            }
+        }
+        return *this;
+    }
+    ~StaticVector() { clear(); }
+
+    static constexpr std::size_t capacity() { return N; }
+    std::size_t size() const { return num; }
+    bool empty() const { return num == 0; }
+
+    T *data() { return std::launder(reinterpret_cast<T *>(storage)); }
+    const T *data() const {
+        return std::launder(reinterpret_cast<const T *>(storage));
+    }
+    iterator begin() { return data(); }
+    iterator end() { return data() + num; }
+    const_iterator begin() const { return data(); }
+    const_iterator end() const { return data() + num; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+
+    T &operator[](std::size_t i) {
+        assert(i < num && "out of range in StaticVector");
+        return data()[i];
+    }
+    const T &operator[](std::size_t i) const {
+        assert(i < num && "out of range in StaticVector");
+        return data()[i];
+    }
+    T &front() { return (*this)[0]; }
+    const T &front() const { return (*this)[0]; }
+    T &back() { return (*this)[num - 1]; }
+    const T &back() const { return (*this)[num - 1]; }
+
+    template <typename... Args>
+    T &emplace_back(Args &&...args) {
+        assert(num < N && "StaticVector overflow");
+        T *p = new (storage + sizeof(T) * num) T(std::forward<Args>(args)...);
+        num++;
+        return *p;
+    }
+    void push_back(const T &v) { emplace_back(v); }
+    void push_back(T &&v) { emplace_back(std::move(v)); }
+    void pop_back() {
+        assert(num > 0 && "pop_back from empty StaticVector");
+        data()[--num].~T();
+    }
+    void clear() {
+        while (num > 0) {
+            pop_back();
+        }
+    }
+
+    bool operator==(const StaticVector &other) const {
+        return num == other.num && std::equal(begin(), end(), other.begin());
+    }
+    bool operator!=(const StaticVector &other) const {
+        return !(*this == other);
+    }
+};
+} // namespace PUMILA_NS
@@ -1,24 +1,31 @@
 #pragma once
 #include "def.h"
 #include "field3.h"
+#include "field_snapshot.h"
 #include "chain.h"
 #include "pumila/garbage.h"
+#include <algorithm>
 #include <memory>
-#include <optional>
 #include <vector>
 #include <cassert>
 #include <iostream>
 
 namespace PUMILA_NS {
+/*!
+ * \brief 1ターン分の記録
+ *
+ * 盤面はFieldSnapshotで持つので、前後のターンや相手のStepResultと
+ * 同じ時点の盤面はコピーせず共有する
+ */
 struct StepResult {
     /*!
      * putするまえ (Fallの直前)
      */
-    FieldState3 field_before;
+    FieldSnapshot field_before;
     /*!
      * おじゃまが降った後 (Free)
      */
-    std::optional<FieldState3> field_after;
+    FieldSnapshot field_after;
     /*!
      * 自分の連鎖 (Fall)
      */
@@ -33,12 +40,12 @@ struct StepResult {
      * 自分のfield_before時点(Free)の相手のfield
      * 相手連鎖中の場合は相手連鎖終了後のfieldになる
      */
-    std::optional<FieldState3> op_field_before;
+    FieldSnapshot op_field_before;
     /*!
      * 自分のfield_after時点(Free = 自フィールドに降った直後)の相手のfield
      * 相手連鎖中の場合は相手連鎖終了後のfieldになる
      */
-    std::optional<FieldState3> op_field_after;
+    FieldSnapshot op_field_after;
     /*!
      * 自分のbefore→after間(Free→Free)に送られてきたおじゃま
      */
@@ -48,7 +55,7 @@ struct StepResult {
      */
     std::vector<std::pair<std::size_t, std::size_t>> garbage_fell_pos;
 
-    explicit StepResult(const FieldState3 &field_before)
+    explicit StepResult(const FieldSnapshot &field_before)
         : field_before(field_before), field_after(), chains(), garbage_send(),
           op_field_before(), op_field_after(), garbage_recv(),
           garbage_fell_pos() {}
@@ -72,12 +79,27 @@ struct StepResult {
         return true;
     }
 
+    /*!
+     * \brief 同じ内容の別のStepResult (GameSim::restore()用)
+     *
+     * 盤面とGarbageGroupは共有する
+     */
+    std::shared_ptr<StepResult> clone() const {
+        auto c = std::make_shared<StepResult>(field_before);
+        c->field_after = field_after;
+        c->chains = chains;
+        c->garbage_send = garbage_send;
+        c->op_field_before = op_field_before;
+        c->op_field_after = op_field_after;
+        c->garbage_recv = garbage_recv;
+        c->garbage_fell_pos = garbage_fell_pos;
+        return c;
+    }
+
     std::shared_ptr<StepResult> next() const {
         assert(field_after);
-        auto n = std::make_shared<StepResult>(*field_after);
-        if (op_field_after) {
-            n->op_field_before = op_field_after;
-        }
+        auto n = std::make_shared<StepResult>(field_after);
+        n->op_field_before = op_field_after;
         return n;
     }
 };
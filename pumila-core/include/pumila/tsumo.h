@@ -0,0 +1,55 @@
+#pragma once
+#include "def.h"
+#include "action.h"
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace PUMILA_NS {
+/*!
+ * \brief 配ぷよ(ツモ)の列
+ *
+ * seedから最初にLENGTH組をPhiloxEngineで生成し、以降は変更しない。
+ * LENGTH組を使い切ったら先頭に戻る。
+ * FieldState3どうしでshared_ptrで共有し、各FieldState3は位置だけ持つ
+ */
+class Tsumo {
+  public:
+    static constexpr std::size_t LENGTH = 128;
+    /*!
+     * \brief 配ぷよの生成に使うPhiloxEngineのstream
+     * (seedが同じでもおじゃまの配置などとは別の乱数になる)
+     */
+    static constexpr std::uint64_t STREAM = 0;
+
+  private:
+    std::uint_fast32_t seed_;
+    std::array<std::pair<Puyo, Puyo>, LENGTH> pairs;
+
+  public:
+    PUMILA_DLL explicit Tsumo(std::uint_fast32_t seed);
+
+    /*!
+     * \brief 同じseedのTsumoがすでにあればそれを、なければ新しく作って返す
+     *
+     * スレッドセーフ
+     */
+    PUMILA_DLL static std::shared_ptr<const Tsumo>
+    share(std::uint_fast32_t seed);
+
+    std::uint_fast32_t seed() const { return seed_; }
+    /*!
+     * \brief i番目の組 (bottom, top)
+     */
+    const std::pair<Puyo, Puyo> &at(std::size_t i) const {
+        return pairs[i % LENGTH];
+    }
+    /*!
+     * \brief i番目の組を初期位置のPuyoPairとして返す
+     */
+    PuyoPair pair(std::size_t i) const {
+        return PuyoPair(at(i).first, at(i).second);
+    }
+};
+} // namespace PUMILA_NS
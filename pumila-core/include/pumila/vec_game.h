@@ -0,0 +1,135 @@
+#pragma once
+#include "def.h"
+#include "game.h"
+#include "matrix.h"
+#include "philox.h"
+#include "models/pumila14.h"
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace PUMILA_NS {
+/*!
+ * \brief 複数のゲームをまとめて進める学習用の環境
+ *
+ * env_num個のゲーム (versusなら2人ずつの対戦) を持ち、
+ * step()で全プレイヤーのactionを受け取って、
+ * 各ゲームをいずれかのプレイヤーがneedsAction()になるまで
+ * スレッドプールで並列にGameSim::fastForward()する
+ * (GameSim::headlessなのでFallPhaseの表示用の盤面は作らない)。
+ *
+ * プレイヤーiはゲームi / players()の(i % players())人目で、
+ * 結果はすべてプレイヤー順に並んだ連続したバッファで返る
+ */
+class VecGameSim {
+    bool versus;
+    bool enable_garbage;
+    std::vector<std::shared_ptr<GameSim>> sims;
+    /*!
+     * \brief ゲームごとの乱数 (リセット時のseedを決める)
+     */
+    std::vector<PhiloxEngine> rnds;
+    /*!
+     * \brief 最後にneedsAction()だった時点のtotalScore (報酬の計算用)
+     */
+    std::vector<int> last_score;
+
+    Matrix obs;
+    std::vector<double> reward_buf;
+    std::vector<std::uint8_t> done_buf, needs_action_buf, legal_buf;
+
+    void resetEnv(std::size_t env);
+    void stepEnv(std::size_t env, const int *actions);
+    /*!
+     * \brief 各プレイヤーのneedsActionとobservationを更新し、
+     * 報酬を計算する
+     */
+    void observeEnv(std::size_t env);
+
+  public:
+    /*!
+     * \param env_num ゲームの数
+     * \param versus trueなら各ゲームを2人の対戦にする (同じ配ぷよを使う)
+     * \param seed 全ゲームの配ぷよはこのseedから決まる
+     *
+     * reset()を呼ぶので、スレッドプールのタスクの中で作らないこと
+     */
+    PUMILA_DLL explicit VecGameSim(
+        std::size_t env_num, bool versus = false,
+        std::uint64_t seed = std::random_device()(),
+        bool enable_garbage = true);
+
+    VecGameSim(const VecGameSim &) = delete;
+    VecGameSim &operator=(const VecGameSim &) = delete;
+
+    std::size_t envNum() const { return rnds.size(); }
+    std::size_t players() const { return versus ? 2 : 1; }
+    std::size_t agentNum() const { return sims.size(); }
+
+    /*!
+     * \brief すべてのゲームを新しく始める
+     *
+     * ゲームごとにスレッドプールのタスクを投げて待つので、
+     * スレッドプールのタスクの中から呼ぶとデッドロックする
+     */
+    PUMILA_DLL void reset(std::uint64_t seed);
+
+    /*!
+     * \brief needsAction()のプレイヤーにactions[i]番目のactionで置かせ、
+     * 全ゲームを次の判断時まで進める
+     * \param actions agentNum()個のactionsのindex
+     * (needsAction()でないプレイヤーの分は無視される)
+     *
+     * 終わったゲームはdones()を立てて自動でリセットする。
+     * 範囲外のactionがあればstd::out_of_rangeを投げ、何も進めない。
+     * reset()と同じくスレッドプールのタスクを待つので、
+     * スレッドプールのタスクの中から呼ぶとデッドロックする
+     */
+    PUMILA_DLL void step(const int *actions);
+    void step(const std::vector<int> &actions) {
+        assert(actions.size() == agentNum());
+        step(actions.data());
+    }
+
+    /*!
+     * \brief (agentNum() * ACTIONS_NUM) x Pumila14::FEATURE_NUM
+     *
+     * プレイヤーiの各actionの特徴量はi * ACTIONS_NUM行目から。
+     * needsAction()でないプレイヤーの分は0
+     */
+    const Matrix &observations() const { return obs; }
+    /*!
+     * \brief 前回needsAction()だった時から今回までの連鎖の点数
+     * (Pumila14::reward()と同じ)
+     *
+     * needsAction()でないプレイヤーは0
+     */
+    const std::vector<double> &rewards() const { return reward_buf; }
+    /*!
+     * \brief このstep()でゲームが終わり、リセットされたかどうか
+     *
+     * 対戦ではどちらかが終わったら両方のプレイヤーに立つ
+     */
+    const std::vector<std::uint8_t> &dones() const { return done_buf; }
+    /*!
+     * \brief agentNum() x ACTIONS_NUM: 各actionが置けるかどうか
+     * (FieldState3::legalActions())
+     *
+     * needsAction()でないプレイヤーの分は0
+     */
+    const std::vector<std::uint8_t> &legalActions() const { return legal_buf; }
+    /*!
+     * \brief 次のstep()でactionが使われるかどうか
+     */
+    const std::vector<std::uint8_t> &needsAction() const {
+        return needs_action_buf;
+    }
+
+    const std::shared_ptr<GameSim> &sim(std::size_t agent) const {
+        return sims.at(agent);
+    }
+};
+} // namespace PUMILA_NS
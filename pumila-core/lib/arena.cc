@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <pumila/action.h>
+#include <pumila/arena.h>
+#include <pumila/models/common.h>
+#include <pumila/philox.h>
+
+namespace PUMILA_NS {
+Arena::Policy Arena::randomPolicy(std::uint64_t seed) {
+    return [seed](const StepResult &step) {
+        // 状態を持たないので複数スレッドから呼んでも結果が変わらない
+        return static_cast<int>(
+            Philox::block(seed, step.field_before->pack().hash())[0] %
+            ACTIONS_NUM);
+    };
+}
+
+Arena::Policy Arena::greedyPolicy() {
+    return [](const StepResult &step) {
+        int best_a = 0;
+        long long best_value = std::numeric_limits<long long>::min();
+        for (int a = 0; a < ACTIONS_NUM; a++) {
+            FieldState3 field = *step.field_before;
+            field.updateNext({field.getNext(0), actions[a]});
+            bool in_field = field.putNext();
+            ChainSummary summary = field.deleteChainSummary();
+            const auto &heights = field.heights();
+            long long value =
+                static_cast<long long>(summary.total_score) * 16 -
+                static_cast<long long>(
+                    *std::max_element(heights.begin(), heights.end()));
+            if (!in_field || field.isGameOver()) {
+                value = std::numeric_limits<long long>::min() + 1;
+            }
+            if (value > best_value) {
+                best_a = a;
+                best_value = value;
+            }
+        }
+        return best_a;
+    };
+}
+
+Arena::GameResult Arena::playGame(typename std::mt19937::result_type seed,
+                                  Result *stats) const {
+    std::array<std::shared_ptr<GameSim>, 2> players = {
+        std::make_shared<GameSim>(seed, enable_garbage),
+        std::make_shared<GameSim>(seed, enable_garbage),
+    };
+    players[0]->setOpponentSim(players[1]);
+    players[0]->headless = players[1]->headless = true;
+    std::vector<std::shared_ptr<GameSim>> sims(players.begin(), players.end());
+    std::array<std::vector<std::shared_ptr<StepResult>>, 2> steps;
+
+    GameResult result;
+    while (!players[0]->is_over && !players[1]->is_over &&
+           result.frames < max_frames) {
+        for (std::size_t p = 0; p < 2; p++) {
+            if (!players[p]->needsAction()) {
+                continue;
+            }
+            int a = policies[p](*players[p]->current_step);
+            if (a < 0 || a >= ACTIONS_NUM) {
+                throw std::out_of_range("Arena: policy " + std::to_string(p) +
+                                        " returned invalid action " +
+                                        std::to_string(a));
+            }
+            steps[p].push_back(players[p]->current_step);
+            players[p]->put(actions[a]);
+        }
+        result.frames += GameSim::fastForward(sims, max_frames - result.frames);
+    }
+    if (players[0]->is_over != players[1]->is_over) {
+        result.winner = players[0]->is_over ? 1 : 0;
+    }
+    for (std::size_t p = 0; p < 2; p++) {
+        result.score[p] = players[p]->field->totalScore();
+    }
+
+    if (stats) {
+        stats->games++;
+        if (result.winner >= 0) {
+            stats->wins[result.winner]++;
+        } else {
+            stats->draws++;
+        }
+        stats->frames_sum += result.frames;
+        for (std::size_t p = 0; p < 2; p++) {
+            stats->score_sum[p] += result.score[p];
+            for (const auto &step : steps[p]) {
+                // 最後のターンは連鎖の途中で終わっていることがある
+                if (step->field_after) {
+                    stats->chain_hist[p][std::min(step->chains.size(),
+                                                  MAX_CHAIN_NUM)]++;
+                }
+            }
+        }
+    }
+    if (record) {
+        result.steps = std::move(steps);
+    }
+    return result;
+}
+
+Arena::Result Arena::run(std::size_t games, std::uint64_t seed) const {
+    std::size_t worker_num =
+        std::min<std::size_t>(games, pool.get_thread_count());
+    std::vector<Result> stats(worker_num);
+    std::vector<GameResult> records(record ? games : 0);
+    std::atomic<std::size_t> next = 0;
+
+    std::vector<std::future<void>> workers;
+    for (std::size_t w = 0; w < worker_num; w++) {
+        workers.push_back(pool.submit_task([&, w] {
+            try {
+                std::size_t i;
+                while ((i = next++) < games) {
+                    auto result = playGame(PhiloxEngine(seed, i)(), &stats[w]);
+                    if (record) {
+                        records[i] = std::move(result);
+                    }
+                }
+            } catch (...) {
+                // 残りのゲームは始めない
+                next = games;
+                throw;
+            }
+        }));
+    }
+    for (auto &worker : workers) {
+        worker.wait();
+    }
+    for (auto &worker : workers) {
+        worker.get();
+    }
+
+    Result total;
+    for (const auto &s : stats) {
+        total.games += s.games;
+        total.draws += s.draws;
+        total.frames_sum += s.frames_sum;
+        for (std::size_t p = 0; p < 2; p++) {
+            total.wins[p] += s.wins[p];
+            total.score_sum[p] += s.score_sum[p];
+            for (std::size_t n = 0; n <= MAX_CHAIN_NUM; n++) {
+                total.chain_hist[p][n] += s.chain_hist[p][n];
+            }
+        }
+    }
+    total.records = std::move(records);
+    return total;
+}
+} // namespace PUMILA_NS
@@ -0,0 +1,309 @@
+#include <pumila/board.h>
+#include <pumila/philox.h>
+#include <algorithm>
+#include <bit>
+#include <cassert>
+
+namespace PUMILA_NS {
+namespace {
+/*!
+ * \brief Zobristハッシュの乱数 (色, BitBoardのbit位置 (hiは64〜))
+ */
+using ZobristTable =
+    std::array<std::array<std::uint64_t, 128>, PuyoBoard::PLANE_NUM>;
+constexpr ZobristTable makeZobristTable() {
+    ZobristTable table = {};
+    for (std::size_t i = 0; i < PuyoBoard::PLANE_NUM; i++) {
+        for (std::size_t b = 0; b < 128; b += 2) {
+            auto r = Philox::block(0x5a0b7157, i * 128 + b);
+            table[i][b] = (std::uint64_t{r[0]} << 32) | r[1];
+            table[i][b + 1] = (std::uint64_t{r[2]} << 32) | r[3];
+        }
+    }
+    return table;
+}
+constexpr ZobristTable zobrist_table = makeZobristTable();
+
+constexpr std::size_t PACKED_PLANE_BITS =
+    PuyoBoard::WIDTH * PuyoBoard::HEIGHT;
+} // namespace
+
+void PuyoBoard::toggleHash(std::size_t i, const BitBoard &diff) {
+    for (std::uint64_t w = diff.lo; w; w &= w - 1) {
+        zobrist ^= zobrist_table[i][std::countr_zero(w)];
+    }
+    for (std::uint64_t w = diff.hi; w; w &= w - 1) {
+        zobrist ^= zobrist_table[i][64 + std::countr_zero(w)];
+    }
+}
+void PuyoBoard::rehash() {
+    zobrist = 0;
+    for (std::size_t i = 0; i < PLANE_NUM; i++) {
+        toggleHash(i, planes[i]);
+    }
+}
+
+void PuyoBoard::set(std::size_t x, std::size_t y, Puyo p) {
+    assert(inRange(x, y) && "out of range in PuyoBoard::set");
+    BitBoard c = BitBoard::cell(x, y);
+    for (std::size_t i = 0; i < PLANE_NUM; i++) {
+        if (!(planes[i] & c).empty()) {
+            toggleHash(i, c);
+            planes[i] &= ~c;
+        }
+    }
+    if (p != Puyo::none) {
+        planes[planeIndex(p)] |= c;
+        toggleHash(planeIndex(p), c);
+        if (y >= column_heights[x]) {
+            column_heights[x] = static_cast<std::uint8_t>(y + 1);
+        }
+    } else if (y + 1 == column_heights[x]) {
+        updateHeights(1u << x);
+    }
+    updated |= c;
+}
+
+Puyo PuyoBoard::get(std::size_t x, std::size_t y) const {
+    assert(inRange(x, y) && "out of range in PuyoBoard::get");
+    for (std::size_t i = 0; i < PLANE_NUM; i++) {
+        if (planes[i].test(x, y)) {
+            return planePuyo(i);
+        }
+    }
+    return Puyo::none;
+}
+
+BitBoard PuyoBoard::connection(std::size_t x, std::size_t y) const {
+    Puyo here = get(x, y);
+    if (here == Puyo::none || here == Puyo::garbage) {
+        return BitBoard{};
+    }
+    return BitBoard::floodFill(BitBoard::cell(x, y),
+                               planes[planeIndex(here)]);
+}
+PuyoGroupList PuyoBoard::findGroups(const BitBoard &seeds,
+                                    int min_size) const {
+    PuyoGroupList groups;
+    const BitBoard &garbage = planes[planeIndex(Puyo::garbage)];
+    for (std::size_t i = 0; i < planeIndex(Puyo::garbage); i++) {
+        // seedsを含むつながりの和集合、以降はこの中だけ調べればよい
+        BitBoard rest = BitBoard::floodFill(seeds, planes[i]);
+        if (rest.popcount() < min_size) {
+            continue;
+        }
+        while (!rest.empty()) {
+            PuyoGroup g;
+            g.color = planePuyo(i);
+            g.mask = BitBoard::floodFill(rest.lowest(), rest);
+            rest &= ~g.mask;
+            g.size = g.mask.popcount();
+            if (g.size >= min_size) {
+                g.garbage = g.mask.neighbors() & garbage;
+                groups.push_back(g);
+            }
+        }
+    }
+    return groups;
+}
+void PuyoBoard::deleteConnection(const BitBoard &deleted) {
+    const BitBoard &garbage = planes[planeIndex(Puyo::garbage)];
+    deleteCells(deleted | (deleted.neighbors() & garbage));
+}
+void PuyoBoard::deleteCells(const BitBoard &cleared) {
+    for (std::size_t i = 0; i < PLANE_NUM; i++) {
+        toggleHash(i, planes[i] & cleared);
+        planes[i] &= ~cleared;
+    }
+    updated |= cleared;
+    unsigned columns = 0;
+    for (std::size_t x = 0; x < WIDTH; x++) {
+        if (cleared.column(x)) {
+            columns |= 1u << x;
+        }
+    }
+    updateHeights(columns);
+}
+
+Chain PuyoBoard::deleteChain(std::size_t chain_num, const BitBoard &seeds) {
+    Chain chain(chain_num);
+    PuyoGroupList groups = findGroups(seeds & updated, 4);
+    if (groups.empty()) {
+        return chain;
+    }
+    if (groups.size() > 1) {
+        // updatedのマスを行優先で調べた順に並べる
+        std::sort(groups.begin(), groups.end(),
+                  [this](const PuyoGroup &a, const PuyoGroup &b) {
+                      return (a.mask & updated).firstRowMajor() <
+                             (b.mask & updated).firstRowMajor();
+                  });
+    }
+    BitBoard cleared;
+    for (const auto &g : groups) {
+        chain.push_connection(g.color, g.size);
+        cleared |= g.mask | g.garbage;
+    }
+    deleteCells(cleared);
+    return chain;
+}
+unsigned PuyoBoard::fallColumns() {
+    BitBoard occ = occupied();
+    unsigned fell = occ.gapColumns();
+    if (fell) {
+        BitBoard moved;
+        for (std::size_t x = 0; x < WIDTH; x++) {
+            if (fell & (1u << x)) {
+                // 最初の隙間から元の高さまでの範囲が移動する
+                moved |= BitBoard::below(x, occ.height(x)) &
+                         ~BitBoard::below(x, std::countr_one(occ.column(x)));
+            }
+        }
+        ColumnCompressor compress(occ);
+        for (std::size_t i = 0; i < PLANE_NUM; i++) {
+            BitBoard packed = compress(planes[i]);
+            toggleHash(i, planes[i] ^ packed);
+            planes[i] = packed;
+        }
+        updated |= moved;
+        updateHeights(fell);
+    }
+    return fell;
+}
+
+std::vector<Chain> PuyoBoard::deleteChainRecurse() {
+    ChainList chains;
+    deleteChainRecurse(chains);
+    return std::vector<Chain>(chains.begin(), chains.end());
+}
+void PuyoBoard::deleteChainRecurse(ChainList &chains) {
+    std::size_t chains_begin = chains.size();
+    unsigned fell = fallColumns();
+    // chainsが途中から始まっている場合も含め、容量を超えたら打ち切る
+    while (chains.size() < chains.capacity()) {
+        // 2連鎖目以降は、ぷよが落ちた列にしか新しいつながりはできない
+        std::size_t chain_num = chains.size() - chains_begin + 1;
+        Chain chain = chain_num == 1
+                          ? deleteChain(1)
+                          : deleteChain(chain_num, BitBoard::columns(fell));
+        if (chain.isEmpty()) {
+            break;
+        }
+        chains.push_back(std::move(chain));
+        fell = fallColumns();
+        if (!fell) {
+            break;
+        }
+    }
+}
+
+ChainSummary PuyoBoard::deleteChainSummary() {
+    ChainSummary summary;
+    unsigned fell = fallColumns();
+    while (true) {
+        // 2連鎖目以降は、ぷよが落ちた列にしか新しいつながりはできない
+        BitBoard seeds = summary.chain_num == 0
+                             ? updated
+                             : updated & BitBoard::columns(fell);
+        PuyoGroupList groups = findGroups(seeds, 4);
+        if (groups.empty()) {
+            break;
+        }
+        int connection_num = 0, connection_bonus = 0;
+        unsigned colors = 0;
+        BitBoard cleared;
+        for (const auto &g : groups) {
+            connection_num += g.size;
+            connection_bonus += Chain::connectionBonus(g.size);
+            colors |= 1u << planeIndex(g.color);
+            cleared |= g.mask | g.garbage;
+        }
+        deleteCells(cleared);
+        int chain_num = ++summary.chain_num;
+        int bonus = Chain::chainBonus(chain_num) + connection_bonus +
+                    Chain::colorBonus(std::popcount(colors));
+        int score = connection_num * 10 * (bonus ? bonus : 1);
+        summary.scores[chain_num - 1] = score;
+        summary.total_score += score;
+        summary.connection_num += connection_num;
+        fell = fallColumns();
+        if (!fell) {
+            break;
+        }
+    }
+    summary.all_clear = summary.chain_num > 0 && occupied().empty();
+    return summary;
+}
+
+PuyoBoard::ChainMap PuyoBoard::calcChainAll() const {
+    ChainMap chain_map = {};
+    BitBoard occ = occupied();
+    PuyoBoard base = *this;
+    base.clearUpdated();
+    for (const auto &g : findGroups()) {
+        if ((occ & ~(g.mask | g.garbage)).gapColumns() == 0) {
+            // 消しても何も落ちないので連鎖は起きない
+            continue;
+        }
+        PuyoBoard board = base;
+        board.deleteConnection(g);
+        ChainList chains;
+        board.deleteChainRecurse(chains);
+        std::size_t chain_num = chains.size();
+        g.mask.forEachRowMajor([&](std::size_t x, std::size_t y) {
+            chain_map[y][x] = chain_num;
+        });
+    }
+    return chain_map;
+}
+
+PuyoBoard::Packed PuyoBoard::pack() const {
+    Packed packed = {};
+    for (std::size_t j = 0; j < 3; j++) {
+        // Puyoの値のbit jが1の色
+        BitBoard bits;
+        for (std::size_t i = 0; i < PLANE_NUM; i++) {
+            if (static_cast<std::size_t>(planePuyo(i)) & (1u << j)) {
+                bits |= planes[i];
+            }
+        }
+        for (std::size_t x = 0; x < WIDTH; x++) {
+            std::size_t pos = j * PACKED_PLANE_BITS + x * HEIGHT;
+            std::uint64_t col = bits.column(x);
+            packed[pos / 64] |= col << (pos % 64);
+            if (pos % 64 + HEIGHT > 64) {
+                packed[pos / 64 + 1] |= col >> (64 - pos % 64);
+            }
+        }
+    }
+    return packed;
+}
+PuyoBoard PuyoBoard::unpack(const Packed &packed) {
+    std::array<BitBoard, 3> bits;
+    for (std::size_t j = 0; j < 3; j++) {
+        for (std::size_t x = 0; x < WIDTH; x++) {
+            std::size_t pos = j * PACKED_PLANE_BITS + x * HEIGHT;
+            std::uint64_t col = packed[pos / 64] >> (pos % 64);
+            if (pos % 64 + HEIGHT > 64) {
+                col |= packed[pos / 64 + 1] << (64 - pos % 64);
+            }
+            bits[j].setColumn(x, static_cast<std::uint16_t>(col));
+        }
+    }
+    PuyoBoard board;
+    for (std::size_t i = 0; i < PLANE_NUM; i++) {
+        BitBoard plane = BitBoard::full();
+        for (std::size_t j = 0; j < 3; j++) {
+            if (static_cast<std::size_t>(planePuyo(i)) & (1u << j)) {
+                plane &= bits[j];
+            } else {
+                plane &= ~bits[j];
+            }
+        }
+        board.planes[i] = plane;
+    }
+    board.updateHeights((1u << WIDTH) - 1);
+    board.rehash();
+    return board;
+}
+} // namespace PUMILA_NS
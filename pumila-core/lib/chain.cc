@@ -18,30 +18,35 @@ int Chain::chainBonus(int chain_num) {
         return 32 * (chain_num - 3);
     }
 }
+int Chain::connectionBonus(int connection) {
+    if (connection >= 5 && connection <= 10) {
+        return connection - 3;
+    } else if (connection > 10) {
+        return 10;
+    }
+    return 0;
+}
 int Chain::connectionBonus() const {
     int b = 0;
     for (const auto &cn : connections) {
-        int c = cn.second;
-        if (c >= 5 && c <= 10) {
-            b += c - 3;
-        } else if (c > 10) {
-            b += 10;
-        }
+        b += connectionBonus(cn.second);
     }
     return b;
 }
+int Chain::colorBonus(int color_num) {
+    if (color_num <= 3) {
+        return 3 * (color_num - 1);
+    } else {
+        return 12 * (color_num - 3);
+    }
+}
 int Chain::colorBonus() const {
     std::array<bool, 6> colors = {};
     for (const auto &cn : connections) {
         colors[static_cast<int>(cn.first)] = true;
     }
-    int cn =
-        std::count_if(colors.begin(), colors.end(), [](auto c) { return c; });
-    if (cn <= 3) {
-        return 3 * (cn - 1);
-    } else {
-        return 12 * (cn - 3);
-    }
+    return colorBonus(static_cast<int>(
+        std::count_if(colors.begin(), colors.end(), [](auto c) { return c; })));
 }
 int Chain::scoreA() const { return connectionNum() * 10; }
 int Chain::scoreB() const {
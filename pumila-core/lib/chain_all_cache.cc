@@ -0,0 +1,29 @@
+#include <pumila/chain_all_cache.h>
+
+namespace PUMILA_NS {
+ChainAllCache::ChainAllCache(std::size_t capacity) : cache(capacity) {}
+
+PuyoBoard::ChainMap ChainAllCache::calcChainAll(const PuyoBoard &board) {
+    std::uint64_t hash = board.hash();
+    ChainMapPacked packed;
+    if (cache.find(hash, board, packed)) {
+        PuyoBoard::ChainMap chain_map;
+        for (std::size_t y = 0; y < PuyoBoard::HEIGHT; y++) {
+            for (std::size_t x = 0; x < PuyoBoard::WIDTH; x++) {
+                chain_map[y][x] = packed[y * PuyoBoard::WIDTH + x];
+            }
+        }
+        return chain_map;
+    }
+    // 計算中はロックしない
+    PuyoBoard::ChainMap chain_map = board.calcChainAll();
+    for (std::size_t y = 0; y < PuyoBoard::HEIGHT; y++) {
+        for (std::size_t x = 0; x < PuyoBoard::WIDTH; x++) {
+            packed[y * PuyoBoard::WIDTH + x] =
+                static_cast<std::uint8_t>(chain_map[y][x]);
+        }
+    }
+    cache.store(hash, board, packed);
+    return chain_map;
+}
+} // namespace PUMILA_NS
@@ -1,82 +1,40 @@
 #include "pumila/action.h"
 #include <cassert>
+#include <cmath>
 #include <cstddef>
-#include <numeric>
+#include <algorithm>
 #include <pumila/field3.h>
+#include <pumila/philox.h>
 
 namespace PUMILA_NS {
-void FieldState3::set(std::size_t x, std::size_t y, Puyo p) {
-    std::lock_guard lock(mtx);
-    assert(inRange(x, y) && "out of range in FieldState3::set");
-    field.at(y).at(x) = p;
-    updated.at(y).at(x) = true;
-}
-
-Puyo FieldState3::get(std::size_t x, std::size_t y) const {
-    std::lock_guard lock(mtx);
-    assert(inRange(x, y) && "out of range in FieldState3::get");
-    return field.at(y).at(x);
-}
-void FieldState3::clearUpdated() {
-    std::lock_guard lock(mtx);
-    updated = {};
-}
-
-Puyo FieldState3::nextColor() {
-    std::lock_guard lock(mtx);
-    int next_n = static_cast<int>(
-        (static_cast<double>(rnd_next()) - rnd_next.min()) /
-        (static_cast<double>(rnd_next.max()) - rnd_next.min()) * 4.0);
-    switch (next_n) {
-    case 0:
-        return Puyo::red;
-    case 1:
-        return Puyo::blue;
-    case 2:
-        return Puyo::green;
-    case 3:
-    default:
-        return Puyo::yellow;
-    }
-}
-
 PuyoPair FieldState3::getNext(std::size_t i) const {
-    std::lock_guard lock(mtx);
-    assert(i < next.size() && "out of range in FieldState3::getNext");
-    return next.at(i);
-}
-void FieldState3::updateNext(const PuyoPair &pp) {
-    std::lock_guard lock(mtx);
-    next.at(0) = pp;
+    assert(i < NextNum && "out of range in FieldState3::getNext");
+    if (i == 0) {
+        return current;
+    }
+    if (!tsumo) {
+        return PuyoPair();
+    }
+    return tsumo->pair(tsumo_index + i);
 }
+void FieldState3::updateNext(const PuyoPair &pp) { current = pp; }
 void FieldState3::shiftNext() {
-    std::lock_guard lock(mtx);
-    for (std::size_t i = 0; i < NextNum - 1; i++) {
-        next.at(i) = next.at(i + 1);
-    }
-    next.at(NextNum - 1) = PuyoPair(nextColor(), nextColor());
+    tsumo_index++;
+    current = tsumo ? tsumo->pair(tsumo_index) : PuyoPair();
 }
 
 void FieldState3::addGarbage(const std::shared_ptr<GarbageGroup> &garbage) {
     if (garbage) {
-        std::lock_guard lock(mtx);
-        garbage_ready.push_back(garbage);
+        garbage_ready.push(garbage.get());
     }
 }
 std::size_t FieldState3::getGarbageNumTotal() const {
-    std::lock_guard lock(mtx);
-    return std::accumulate(
-        garbage_ready.cbegin(), garbage_ready.cend(),
-        static_cast<std::size_t>(0),
-        [](std::size_t acc, const std::shared_ptr<GarbageGroup> &g) {
-            return acc + g->restGarbageNum();
-        });
+    return garbage_ready.totalNum();
 }
 
 bool FieldState3::putNext() {
-    std::lock_guard lock(mtx);
     auto [yb, yt] = getNextHeight();
-    clearUpdated();
+    board.clearUpdated();
     PuyoPair action = getNext(0);
     if (yt < FieldState3::HEIGHT) {
         set(action.topX(), yt, action.top);
@@ -90,7 +48,6 @@ bool FieldState3::putNext() {
 
 std::pair<std::size_t, std::size_t>
 FieldState3::getNextHeight(const Action &action) const {
-    std::lock_guard lock(mtx);
     std::size_t yb = getHeight(action.bottomX()), yt = getHeight(action.topX());
     if (action.rot == PuyoPair::Rotation::vertical) {
         yt++;
@@ -100,26 +57,18 @@ FieldState3::getNextHeight(const Action &action) const {
     }
     return std::make_pair(yb, yt);
 }
-std::size_t FieldState3::getHeight(std::size_t x) const {
-    std::lock_guard lock(mtx);
-    for (std::size_t y = HEIGHT; y >= 1; y--) {
-        if (get(x, y - 1) != Puyo::none) {
-            return y;
-        }
-    }
-    return 0;
-}
-
 void FieldState3::putGarbage(
     std::vector<std::pair<std::size_t, std::size_t>> *garbage_list) {
-    static std::mt19937 rnd_general{std::random_device()()};
-    std::lock_guard lock(mtx);
     std::size_t r = 0;
     std::size_t garbage_num_all = getGarbageNumTotal();
     std::size_t garbage_num_actual;
     for (; (r + 1) * WIDTH <= garbage_num_all && r < 5; r++) {
         for (std::size_t x = 0; x < WIDTH; x++) {
             auto y = getHeight(x);
+            // 埋まっている列に降るおじゃまは消える
+            if (y >= HEIGHT) {
+                continue;
+            }
             set(x, y, Puyo::garbage);
             if (garbage_list) {
                 garbage_list->emplace_back(x, y);
@@ -128,9 +77,13 @@ void FieldState3::putGarbage(
     }
     if (r < 5) {
         std::array<int, WIDTH> target_x = {0, 1, 2, 3, 4, 5};
-        std::shuffle(target_x.begin(), target_x.end(), rnd_general);
+        PhiloxEngine rnd(garbage_seed, GARBAGE_STREAM | garbage_put_count++);
+        rnd.shuffle(target_x.begin(), target_x.end());
         for (std::size_t i = 0; r * WIDTH + i < garbage_num_all; i++) {
             auto y = getHeight(target_x[i]);
+            if (y >= HEIGHT) {
+                continue;
+            }
             set(target_x[i], y, Puyo::garbage);
             if (garbage_list) {
                 garbage_list->emplace_back(target_x[i], y);
@@ -140,38 +93,159 @@ void FieldState3::putGarbage(
     } else {
         garbage_num_actual = WIDTH * 5;
     }
-    while (garbage_num_actual > 0) {
-        auto &gg = garbage_ready.front();
-        garbage_num_actual -= gg->fall(garbage_num_actual);
-        if (gg->done()) {
-            garbage_ready.erase(garbage_ready.begin());
-        }
-    }
+    garbage_ready.fall(garbage_num_actual);
+}
+
+ChainSummary FieldState3::deleteChainSummary() {
+    ChainSummary summary = board.deleteChainSummary();
+    total_score += summary.total_score;
+    summary.garbage = static_cast<std::size_t>(
+        (garbage_score + summary.total_score) / GARBAGE_RATE);
+    return summary;
 }
 
 std::size_t FieldState3::calcGarbage(int score_add) {
-    std::lock_guard lock(mtx);
     garbage_score += score_add;
     std::size_t g = garbage_score / GARBAGE_RATE;
     garbage_score %= GARBAGE_RATE;
     return g;
 }
 std::size_t FieldState3::cancelGarbage(std::size_t garbage_num) {
-    std::lock_guard lock(mtx);
-    std::size_t cancelled = 0;
-    while (cancelled < garbage_num && !garbage_ready.empty()) {
-        auto &gg = garbage_ready.front();
-        cancelled += gg->cancel(garbage_num - cancelled);
-        if (gg->done()) {
-            garbage_ready.erase(garbage_ready.begin());
+    return garbage_ready.cancel(garbage_num);
+}
+
+FieldState3::Packed FieldState3::pack() const {
+    Packed packed = {};
+    packed.board = board.pack();
+    if (tsumo) {
+        packed.tsumo_seed = tsumo->seed();
+        packed.nexts |= Packed::HAS_TSUMO;
+    }
+    packed.tsumo_index = static_cast<std::uint32_t>(tsumo_index);
+    for (std::size_t i = 0; i < NextNum; i++) {
+        PuyoPair next = getNext(i);
+        packed.nexts |= static_cast<std::uint32_t>(next.bottom) << (i * 6);
+        packed.nexts |= static_cast<std::uint32_t>(next.top) << (i * 6 + 3);
+    }
+    packed.nexts |= static_cast<std::uint32_t>(current.x) << 18;
+    packed.nexts |= static_cast<std::uint32_t>(current.rot) << 21;
+    packed.garbage_num = static_cast<std::uint32_t>(getGarbageNumTotal());
+    packed.garbage_put_count = static_cast<std::uint32_t>(garbage_put_count);
+    packed.garbage_score = garbage_score;
+    packed.total_score = total_score;
+    return packed;
+}
+FieldState3 FieldState3::unpack(const Packed &packed) {
+    FieldState3 field =
+        (packed.nexts & Packed::HAS_TSUMO)
+            ? FieldState3(Tsumo::share(
+                  static_cast<std::uint_fast32_t>(packed.tsumo_seed)))
+            : FieldState3();
+    field.board = PuyoBoard::unpack(packed.board);
+    field.tsumo_index = packed.tsumo_index;
+    field.current = PuyoPair(
+        static_cast<Puyo>(packed.nexts & 7),
+        static_cast<Puyo>((packed.nexts >> 3) & 7),
+        Action{static_cast<int>((packed.nexts >> 18) & 7),
+               static_cast<Action::Rotation>((packed.nexts >> 21) & 3)});
+    field.garbage_ready.push(nullptr, packed.garbage_num);
+    field.garbage_put_count = packed.garbage_put_count;
+    field.garbage_score = packed.garbage_score;
+    field.total_score = packed.total_score;
+    return field;
+}
+std::uint64_t FieldState3::Packed::hash() const {
+    // 各wordを混ぜ、最後にsplitmix64の仕上げで全bitに行き渡らせる
+    std::uint64_t h = 0;
+    auto mix = [&h](std::uint64_t v) {
+        h = (h ^ v) * 0x9e3779b97f4a7c15ull;
+        h ^= h >> 32;
+    };
+    for (auto w : board) {
+        mix(w);
+    }
+    mix(tsumo_seed);
+    mix((std::uint64_t{tsumo_index} << 32) | nexts);
+    mix((std::uint64_t{garbage_num} << 32) | garbage_put_count);
+    mix((std::uint64_t{static_cast<std::uint32_t>(garbage_score)} << 32) |
+        static_cast<std::uint32_t>(total_score));
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    return h ^ (h >> 31);
+}
+
+/*!
+ * \brief legalTable()[x][h]: x列目の高さがhのとき置けるactionsのbitmask
+ * (x列目を使わないactionは常に置ける)
+ */
+using LegalTable =
+    std::array<std::array<std::uint32_t, FieldState3::HEIGHT + 1>,
+               FieldState3::WIDTH>;
+static LegalTable makeLegalTable() {
+    LegalTable table;
+    for (std::size_t x = 0; x < FieldState3::WIDTH; x++) {
+        for (std::size_t h = 0; h <= FieldState3::HEIGHT; h++) {
+            table[x][h] = FieldState3::ALL_ACTIONS;
+            for (int a = 0; a < ACTIONS_NUM; a++) {
+                // 縦置きなら2段、横置きなら1段使う
+                std::size_t used =
+                    (actions[a].bottomX() == static_cast<int>(x)) +
+                    (actions[a].topX() == static_cast<int>(x));
+                if (h + used > FieldState3::HEIGHT) {
+                    table[x][h] &= ~(1u << a);
+                }
+            }
+        }
+    }
+    return table;
+}
+static const LegalTable &legalTable() {
+    static const LegalTable table = makeLegalTable();
+    return table;
+}
+std::uint32_t FieldState3::legalActions() const {
+    const auto &table = legalTable();
+    std::uint32_t mask = ALL_ACTIONS;
+    const auto &h = heights();
+    for (std::size_t x = 0; x < WIDTH; x++) {
+        mask &= table[x][h[x]];
+    }
+    return mask;
+}
+std::array<int, ACTIONS_NUM> FieldState3::placementGroups() const {
+    std::array<int, ACTIONS_NUM> group;
+    std::array<std::uint32_t, ACTIONS_NUM> keys = {};
+    std::uint32_t legal = legalActions();
+    PuyoPair pp = getNext(0);
+    auto cell = [](std::size_t x, std::size_t y, Puyo p) {
+        return static_cast<std::uint32_t>(((x * HEIGHT + y) << 3) |
+                                          static_cast<std::size_t>(p));
+    };
+    for (int a = 0; a < ACTIONS_NUM; a++) {
+        group[a] = -1;
+        if (!(legal >> a & 1)) {
+            continue;
+        }
+        auto [yb, yt] = getNextHeight(actions[a]);
+        std::uint32_t cb = cell(actions[a].bottomX(), yb, pp.bottom);
+        std::uint32_t ct = cell(actions[a].topX(), yt, pp.top);
+        // どちらのぷよがどちらのマスに行ったかは区別しない
+        keys[a] = cb < ct ? (cb << 16 | ct) : (ct << 16 | cb);
+        group[a] = a;
+        for (int b = 0; b < a; b++) {
+            if (group[b] == b && keys[b] == keys[a]) {
+                group[a] = b;
+                break;
+            }
         }
     }
-    return cancelled;
+    return group;
 }
 
 bool FieldState3::checkNextCollision(const Action &action) const {
-    std::lock_guard lock(mtx);
-    PuyoPair pp{getNext(0), action};
+    return checkNextCollision(PuyoPair{getNext(0), action});
+}
+bool FieldState3::checkNextCollision(const PuyoPair &pp) const {
     return (
         (std::floor(pp.bottomY()) < HEIGHT && std::floor(pp.topY()) < HEIGHT &&
          (!inRange(pp.bottomX(), std::floor(pp.bottomY())) ||
@@ -185,114 +259,22 @@ bool FieldState3::checkNextCollision(const Action &action) const {
           get(pp.topX(), std::ceil(pp.topY())) != Puyo::none)));
 }
 
-PuyoConnection FieldState3::deleteConnection(std::size_t x, std::size_t y) {
-    std::lock_guard lock(mtx);
-    PuyoConnection deleted;
-    deleteConnectionImpl(x, y, deleted);
-    return deleted;
-}
-void FieldState3::deleteConnectionImpl(std::size_t x, std::size_t y,
-                                       PuyoConnection &deleted) {
-    std::lock_guard lock(mtx);
-    Puyo here = get(x, y);
-    if (here == Puyo::none) {
-        return;
-    }
-    set(x, y, Puyo::none);
-    if (here == Puyo::garbage) {
-        deleted.garbage.emplace_back(x, y);
-    } else {
-        deleted.colored.emplace_back(x, y);
-        const std::array<std::pair<std::size_t, std::size_t>, 4> near{{
-            {x + 1, y},
-            {x - 1, y},
-            {x, y + 1},
-            {x, y - 1},
-        }};
-        for (const auto &[nx, ny] : near) {
-            if (inRange(nx, ny) &&
-                (get(nx, ny) == here || get(nx, ny) == Puyo::garbage)) {
-                deleteConnectionImpl(nx, ny, deleted);
-            }
-        }
-    }
-}
-
 Chain FieldState3::deleteChain(std::size_t chain_num) {
-    std::lock_guard lock(mtx);
-    Chain chain(chain_num);
-    FieldState3 state_tmp = *this;
-    for (std::size_t y = 0; y < HEIGHT; y++) {
-        for (std::size_t x = 0; x < WIDTH; x++) {
-            if (updated.at(y).at(x)) {
-                auto connection = state_tmp.deleteConnection(x, y);
-                if (connection.colored.size() >= 4) {
-                    chain.push_connection(get(x, y), connection.colored.size());
-                    deleteConnection(x, y); // thisの盤面にも反映
-                }
-            }
-        }
-    }
+    Chain chain = board.deleteChain(chain_num);
     total_score += chain.score();
     return chain;
 }
-bool FieldState3::fall() {
-    std::lock_guard lock(mtx);
-    bool has_fall = false;
-    for (std::size_t x = 0; x < WIDTH; x++) {
-        for (std::size_t y = 0; y < HEIGHT; y++) {
-            if (get(x, y) == Puyo::none) {
-                for (std::size_t dy = 1; y + dy < HEIGHT; dy++) {
-                    if (get(x, y + dy) != Puyo::none) {
-                        set(x, y, get(x, y + dy));
-                        set(x, y + dy, Puyo::none);
-                        has_fall = true;
-                        break;
-                    }
-                }
-            }
-        }
-    }
-    return has_fall;
-}
-
-std::array<std::array<std::size_t, FieldState3::WIDTH>, FieldState3::HEIGHT>
-FieldState3::calcChainAll() const {
-    std::lock_guard lock(mtx);
-    std::array<std::array<std::size_t, WIDTH>, HEIGHT> chain_map = {};
-    for (std::size_t y = 0; y < HEIGHT; y++) {
-        for (std::size_t x = 0; x < WIDTH; x++) {
-            if (get(x, y) == Puyo::none || get(x, y) == Puyo::garbage ||
-                chain_map.at(y).at(x) != 0) {
-                continue;
-            }
-            FieldState3 state = *this;
-            auto first_connection = state.deleteConnection(x, y);
-            auto chains = state.deleteChainRecurse();
-            for (const auto &pos : first_connection.colored) {
-                chain_map.at(pos.second).at(pos.first) = chains.size();
-            }
-        }
-    }
-    return chain_map;
-}
 
 std::vector<Chain> FieldState3::deleteChainRecurse() {
-    std::lock_guard lock(mtx);
-    std::vector<Chain> chains;
-    while (true) {
-        fall();
-        Chain chain = deleteChain(chains.size() + 1);
-        if (chain.isEmpty()) {
-            break;
-        }
-        chains.push_back(std::move(chain));
-    }
-    return chains;
+    ChainList chains;
+    deleteChainRecurse(chains);
+    return std::vector<Chain>(chains.begin(), chains.end());
 }
-
-int FieldState3::totalScore() const {
-    std::lock_guard lock(mtx);
-    return total_score;
+void FieldState3::deleteChainRecurse(ChainList &chains) {
+    std::size_t chains_begin = chains.size();
+    board.deleteChainRecurse(chains);
+    for (std::size_t i = chains_begin; i < chains.size(); i++) {
+        total_score += chains[i].score();
+    }
 }
 } // namespace PUMILA_NS
@@ -2,12 +2,22 @@
 #include "pumila/step.h"
 #include <memory>
 #include <pumila/game.h>
+#include <algorithm>
 #include <cassert>
+#include <numeric>
+#include <type_traits>
+#include <variant>
 
 namespace PUMILA_NS {
+/*!
+ * \brief PhaseHolderのvariantの要素がフェーズ無し(monostate)かどうか
+ */
+template <typename T>
+constexpr bool isNoPhase = std::is_same_v<std::decay_t<T>, std::monostate>;
+
 GameSim::GameSim(typename std::mt19937::result_type seed, bool enable_garbage)
-    : enable_garbage(enable_garbage), opponent(), field(std::nullopt),
-      phase(nullptr), current_step(nullptr) {
+    : enable_garbage(enable_garbage), opponent(), field(),
+      current_step(nullptr), phase() {
     /*if (model) {
         model_action_thread = std::make_optional<std::thread>([this] {
             while (running.load()) {
@@ -37,8 +47,12 @@ void GameSim::reset(typename std::mt19937::result_type seed) {
     // std::lock_guard lock(step_m);
     // std::lock_guard lock2(field_m);
     field.emplace(seed);
-    phase = std::make_unique<GameSim::FreePhase>(this);
     step_count = 0;
+    frame_count = 0;
+    if (recorder) {
+        recorder->begin(seed, frame_count);
+    }
+    phase.emplace(Phase::free, this);
 }
 
 // void GameSim::stopAction() {
@@ -49,6 +63,60 @@ void GameSim::reset(typename std::mt19937::result_type seed) {
 //     }
 // }
 
+GameSim::Snapshot GameSim::snapshot() const {
+    Snapshot s;
+    field.save(s.field, s.garbage_keep);
+    for (std::size_t i = 0; i < s.garbage_keep.size(); i++) {
+        s.garbage_counts[i] = {s.garbage_keep[i]->cancelledNum(),
+                               s.garbage_keep[i]->fellNum()};
+    }
+    s.phase = phase;
+    // current_stepは次に書き換える時にwritableStep()でコピーする
+    s.current_step = current_step;
+    current_step_shared = true;
+    s.soft_put_target = soft_put_target;
+    s.soft_put_plan = soft_put_plan;
+    s.soft_put_plan_pos = soft_put_plan_pos;
+    s.soft_put_planned = soft_put_planned;
+    s.soft_put_cnt = soft_put_cnt;
+    s.rot_fail = rot_fail;
+    s.rot_fail_count = rot_fail_count;
+    s.is_over = is_over;
+    s.step_count = step_count;
+    s.frame_count = frame_count;
+    return s;
+}
+void GameSim::restore(const Snapshot &s) {
+    field.load(s.field, s.garbage_keep);
+    for (std::size_t i = 0; i < s.garbage_keep.size(); i++) {
+        s.garbage_keep[i]->setCounts(s.garbage_counts[i].first,
+                                     s.garbage_counts[i].second);
+    }
+    phase = s.phase;
+    phase.rebind(this);
+    // snapshotは何度でも使えるように、書き換える時は別に作る
+    current_step = std::const_pointer_cast<StepResult>(s.current_step);
+    current_step_shared = true;
+    soft_put_target = s.soft_put_target;
+    soft_put_plan = s.soft_put_plan;
+    soft_put_plan_pos = s.soft_put_plan_pos;
+    soft_put_planned = s.soft_put_planned;
+    soft_put_cnt = s.soft_put_cnt;
+    rot_fail = s.rot_fail;
+    rot_fail_count = s.rot_fail_count;
+    is_over = s.is_over;
+    step_count = s.step_count;
+    frame_count = s.frame_count;
+}
+StepResult &GameSim::writableStep() {
+    assert(current_step);
+    if (current_step_shared) {
+        current_step = current_step->clone();
+        current_step_shared = false;
+    }
+    return *current_step;
+}
+
 void GameSim::setOpponentSim(const std::shared_ptr<GameSim> &opponent_s) {
     auto prev_opponent_s = opponent.lock();
     if (prev_opponent_s) {
@@ -65,57 +133,89 @@ void GameSim::setOpponentSim(const std::shared_ptr<GameSim> &opponent_s) {
 //     return std::make_shared<FieldState>(*field2());
 // }
 
+bool GameSim::tryMovePair(const FieldState3 &field, PuyoPair &pp, int dx) {
+    if (FieldState3::inRange(pp.bottomX() + dx) &&
+        FieldState3::inRange(pp.topX() + dx) &&
+        (pp.bottomY() > 12 ||
+         field.get(pp.bottomX() + dx, pp.bottomY()) == Puyo::none) &&
+        (pp.topY() > 12 ||
+         field.get(pp.topX() + dx, pp.topY()) == Puyo::none)) {
+        pp.x += dx;
+        return true;
+    }
+    return false;
+}
+int GameSim::tryRotPair(const FieldState3 &field, PuyoPair &pp, int r) {
+    // checkNextCollisionは画面の上での横のはみ出しと
+    // 床より下 (負のyはsize_tに変換される) を見ないので別に調べる
+    auto collides = [&field](const PuyoPair &p) {
+        return !FieldState3::inRange(p.bottomX()) ||
+               !FieldState3::inRange(p.topX()) || p.bottomY() < 0 ||
+               p.topY() < 0 || field.checkNextCollision(p);
+    };
+    PuyoPair new_pp = pp;
+    new_pp.rotate(r);
+    if (!collides(new_pp)) {
+        pp = new_pp;
+        return 1;
+    }
+    PuyoPair new_pp2 = new_pp;
+    new_pp2.y = new_pp.y + 1;
+    if (!collides(new_pp2)) {
+        pp = new_pp2;
+        return 2;
+    }
+    new_pp2.y = new_pp.y;
+    new_pp2.x = new_pp.x + 1;
+    if (!collides(new_pp2)) {
+        pp = new_pp2;
+        return 2;
+    }
+    new_pp2.y = new_pp.y;
+    new_pp2.x = new_pp.x - 1;
+    if (!collides(new_pp2)) {
+        pp = new_pp2;
+        return 2;
+    }
+    return 0;
+}
+
 void GameSim::movePair(int dx) {
     // std::lock_guard lock(step_m);
     if (phase && phase->get() == Phase::free) {
-        // std::lock_guard lock_f(field_m);
-        auto pp = field->getNext(0);
-        if (FieldState3::inRange(pp.bottomX() + dx) &&
-            FieldState3::inRange(pp.topX() + dx) &&
-            (pp.bottomY() > 12 ||
-             field->get(pp.bottomX() + dx, pp.bottomY()) == Puyo::none) &&
-            (pp.topY() > 12 ||
-             field->get(pp.topX() + dx, pp.topY()) == Puyo::none)) {
-            pp.x += dx;
-            field->updateNext(pp);
+        auto field_l = field.lock();
+        auto pp = field_l->getNext(0);
+        if (tryMovePair(*field_l, pp, dx)) {
+            field_l->updateNext(pp);
         }
     }
 }
+int GameSim::applyRotPair(const FieldState3 &field, PuyoPair &pp, int r,
+                          int &rot_fail, int &rot_fail_count) {
+    if (rot_fail_count >= ROT_FAIL_COUNT) {
+        return 0;
+    }
+    if (r == rot_fail) {
+        r *= 2;
+    }
+    rot_fail = 0;
+    int result = tryRotPair(field, pp, r);
+    if (result != 1) {
+        rot_fail_count++;
+    }
+    if (result == 0) {
+        rot_fail = r;
+    }
+    return result;
+}
 void GameSim::rotPair(int r) {
     // std::lock_guard lock(step_m);
-    if (phase && phase->get() == Phase::free &&
-        rot_fail_count < ROT_FAIL_COUNT) {
-        // std::lock_guard lock_f(field_m);
-        PuyoPair new_pp = field->getNext(0);
-        if (r == rot_fail) {
-            r *= 2;
-        }
-        rot_fail = 0;
-        new_pp.rotate(r);
-        if (!field->checkNextCollision(new_pp)) {
-            field->updateNext(new_pp);
-            return;
-        }
-        PuyoPair new_pp2 = new_pp;
-        rot_fail_count++;
-        new_pp2.y = new_pp.y + 1;
-        if (!field->checkNextCollision(new_pp2)) {
-            field->updateNext(new_pp2);
-            return;
-        }
-        new_pp2.y = new_pp.y;
-        new_pp2.x = new_pp.x + 1;
-        if (!field->checkNextCollision(new_pp2)) {
-            field->updateNext(new_pp2);
-            return;
-        }
-        new_pp2.y = new_pp.y;
-        new_pp2.x = new_pp.x - 1;
-        if (!field->checkNextCollision(new_pp2)) {
-            field->updateNext(new_pp2);
-            return;
+    if (phase && phase->get() == Phase::free) {
+        auto field_l = field.lock();
+        PuyoPair new_pp = field_l->getNext(0);
+        if (applyRotPair(*field_l, new_pp, r, rot_fail, rot_fail_count) != 0) {
+            field_l->updateNext(new_pp);
         }
-        rot_fail = r;
     }
 }
 void GameSim::quickDrop() {
@@ -125,8 +225,9 @@ void GameSim::quickDrop() {
         PuyoPair pp = field->getNext(0);
         pp.y = -1;
         field->updateNext(pp);
-        auto f_phase = dynamic_cast<FreePhase *>(phase.get());
+        auto f_phase = phase.getIf<FreePhase>();
         f_phase->put_t = 0;
+        f_phase->dropped = true;
     }
 }
 void GameSim::softDrop() {
@@ -136,44 +237,130 @@ void GameSim::softDrop() {
         PuyoPair pp = field->getNext(0);
         pp.y -= FreePhase::SOFT_SPEED / 60;
         field->updateNext(pp);
-        auto f_phase = dynamic_cast<FreePhase *>(phase.get());
+        auto f_phase = phase.getIf<FreePhase>();
         f_phase->put_t -= 10;
     }
 }
 
+void GameSim::stepSoftPut() {
+    auto f_phase = phase.getIf<FreePhase>();
+    auto field_l = field.lock();
+    PuyoPair pp = field_l->getNext(0);
+    if (f_phase) {
+        // 入力列が無いか予定とずれていたら今の状態から探し直す
+        bool replan = !soft_put_planned ||
+                      (soft_put_plan &&
+                       (soft_put_plan_pos >= soft_put_plan->size() ||
+                        !(*soft_put_plan)[soft_put_plan_pos - 1].matches(
+                            pp, f_phase->put_t, rot_fail, rot_fail_count)));
+        if (replan) {
+            soft_put_plan = SoftPutPlanner::shared().plan(
+                *field_l, pp, f_phase->put_t, std::max(soft_put_cnt - 1, 0),
+                rot_fail, rot_fail_count, *soft_put_target,
+                soft_put_interval);
+            soft_put_plan_pos = 0;
+            soft_put_planned = true;
+        }
+        if (soft_put_plan) {
+            const auto &frame = (*soft_put_plan)[soft_put_plan_pos++];
+            if (frame.rot != 0) {
+                applyRotPair(*field_l, pp, frame.rot, rot_fail,
+                             rot_fail_count);
+            }
+            if (frame.dx != 0) {
+                tryMovePair(*field_l, pp, frame.dx);
+            }
+            if (frame.soft) {
+                pp.y -= FreePhase::SOFT_SPEED / 60;
+                f_phase->put_t -= 10;
+            }
+            field_l->updateNext(pp);
+            if (frame.rot != 0 || frame.dx != 0) {
+                soft_put_cnt = soft_put_interval;
+            } else {
+                soft_put_cnt--;
+            }
+            return;
+        }
+    }
+    // 目標に置けない場合は1つずつ近づける
+    if (static_cast<Action>(pp) == soft_put_target) {
+        softDrop();
+    } else {
+        soft_put_cnt--;
+        if (soft_put_cnt <= 0) {
+            soft_put_cnt = soft_put_interval;
+            if ((static_cast<int>(soft_put_target->rot) -
+                 static_cast<int>(pp.rot) + 4) %
+                    4 ==
+                1) {
+                rotPair(1);
+            } else if (soft_put_target->rot != pp.rot) {
+                rotPair(-1);
+            }
+            if (pp.x < soft_put_target->x) {
+                movePair(1);
+            } else if (pp.x > soft_put_target->x) {
+                movePair(-1);
+            }
+        }
+    }
+}
 void GameSim::step() {
     // std::lock_guard lock(step_m);
     if (soft_put_target) {
-        PuyoPair pp;
-        // std::shared_lock lock_f(field_m);
-        pp = field->getNext(0);
-        if (static_cast<Action>(pp) == soft_put_target) {
-            softDrop();
+        stepSoftPut();
+    }
+    frame_count++;
+    phase.step();
+}
+bool GameSim::needsAction() const {
+    if (!phase || phase->get() != Phase::free || soft_put_target) {
+        return false;
+    }
+    return !phase.getIf<FreePhase>()->dropped;
+}
+int GameSim::idleFrames() const {
+    if (!phase || soft_put_target) {
+        return 0;
+    }
+    return phase.idleFrames();
+}
+int GameSim::fastForward(const std::vector<std::shared_ptr<GameSim>> &sims,
+                         int max_frames) {
+    int frames = 0;
+    while (frames < max_frames) {
+        int skip = max_frames - frames;
+        for (const auto &sim : sims) {
+            if (sim->needsAction()) {
+                return frames;
+            }
+            skip = std::min(skip, sim->idleFrames());
+        }
+        if (skip > 0) {
+            for (const auto &sim : sims) {
+                sim->phase.skip(skip);
+                sim->frame_count += skip;
+            }
+            frames += skip;
         } else {
-            soft_put_cnt--;
-            if (soft_put_cnt <= 0) {
-                soft_put_cnt = soft_put_interval;
-                if ((static_cast<int>(soft_put_target->rot) -
-                     static_cast<int>(pp.rot) + 4) %
-                        4 ==
-                    1) {
-                    rotPair(1);
-                } else if (soft_put_target->rot != pp.rot) {
-                    rotPair(-1);
-                }
-                if (pp.x < soft_put_target->x) {
-                    movePair(1);
-                } else if (pp.x > soft_put_target->x) {
-                    movePair(-1);
-                }
+            for (const auto &sim : sims) {
+                sim->step();
             }
+            frames++;
         }
     }
-    std::unique_ptr<Phase> next_phase = phase->step();
-    if (next_phase) {
-        phase = std::move(next_phase);
+    return frames;
+}
+int GameSim::putTurn(const Action &action) {
+    put(action);
+    std::vector<std::shared_ptr<GameSim>> sims = {shared_from_this()};
+    if (auto sim_op = opponent.lock()) {
+        sims.push_back(sim_op);
     }
+    return fastForward(sims);
 }
+
 void GameSim::put(const Action &action) {
     // std::lock_guard lock(step_m);
     if (phase && phase->get() == Phase::free) {
@@ -187,135 +374,276 @@ void GameSim::put(const Action &action) {
 void GameSim::softPut(const Action &action) {
     // std::lock_guard lock(step_m);
     soft_put_target = action;
+    soft_put_plan = nullptr;
+    soft_put_planned = false;
 }
 
 GameSim::GarbagePhase::GarbagePhase(GameSim *sim) : Phase(sim), wait_t(WAIT_T) {
     assert(sim->current_step);
-    std::size_t garbage_send;
+    std::size_t garbage_send, garbage_created, garbage_ready;
     auto sim_op = sim->opponent.lock();
-    // std::lock_guard lock(sim->field_m);
-    garbage_send = sim->field->calcGarbage(std::accumulate(
-        sim->current_step->chains.cbegin(), sim->current_step->chains.cend(), 0,
-        [](int acc, const Chain &chain) { return acc + chain.score(); }));
-    garbage_send -= sim->field->cancelGarbage(garbage_send);
+    {
+        auto field = sim->field.lock();
+        garbage_created = field->calcGarbage(std::accumulate(
+            sim->current_step->chains.cbegin(),
+            sim->current_step->chains.cend(), 0,
+            [](int acc, const Chain &chain) { return acc + chain.score(); }));
+        garbage_ready = field->getGarbageNumTotal();
+        garbage_send =
+            garbage_created - field->cancelGarbage(garbage_created);
+    }
+    StepResult &step = sim->writableStep();
     if (garbage_send > 0) {
-        sim->current_step->garbage_send =
-            std::make_shared<GarbageGroup>(garbage_send);
+        step.garbage_send = std::make_shared<GarbageGroup>(garbage_send);
         if (!sim->enable_garbage) {
-            sim->current_step->garbage_send->fallAll();
-            assert(sim->current_step->garbage_send->done());
+            step.garbage_send->fallAll();
+            assert(step.garbage_send->done());
         }
         if (sim_op && sim->enable_garbage) {
-            // std::lock_guard lock(sim_op->field_m);
+            // 相手のcurrent_stepもfieldのロックで保護する
+            auto op_field = sim_op->field.lock();
             if (sim_op->current_step) {
-                sim_op->current_step->garbage_recv.push_back(
-                    sim->current_step->garbage_send);
+                sim_op->writableStep().garbage_recv.push_back(
+                    step.garbage_send);
             }
-            sim_op->field->addGarbage(sim->current_step->garbage_send);
+            sim_op->field.addGarbage(step.garbage_send);
         }
     }
-    // std::lock_guard lock(sim->field_m);
-    if (sim->field->getGarbageNumTotal() == 0) {
+    auto field = sim->field.lock();
+    if (field->getGarbageNumTotal() == 0) {
         wait_t = 0;
     } else {
-        sim->field->putGarbage(&sim->current_step->garbage_fell_pos);
+        field->putGarbage(&step.garbage_fell_pos);
+    }
+    if (sim->recorder) {
+        sim->recorder->garbage(sim->current_step->chains.size(),
+                               garbage_created, garbage_ready,
+                               field->getGarbageNumTotal());
     }
 }
-std::unique_ptr<GameSim::Phase> GameSim::GarbagePhase::step() {
+GameSim::Phase::PhaseEnum GameSim::GarbagePhase::step() {
     wait_t--;
     if (wait_t < 0) {
-        return std::make_unique<GameSim::FreePhase>(sim);
+        return PhaseEnum::free;
     }
-    return nullptr;
+    return PhaseEnum::none;
 }
 
 GameSim::FreePhase::FreePhase(GameSim *sim) : Phase(sim), put_t(PUT_T) {
-    // std::lock_guard lock(sim->field_m);
     auto sim_op = sim->opponent.lock();
+    // 自分のfieldをロックする前に相手のfieldをコピーしておく
+    FieldSnapshot op_field;
+    if (sim_op) {
+        op_field = sim_op->field.snapshot();
+    }
+    auto field = sim->field.lock();
+    // 前ターンのfield_afterと今ターンのfield_beforeは同じものを共有する
+    FieldSnapshot snapshot(*field);
 
     // 前ターンのデータ残り
     if (sim->current_step) {
-        sim->current_step->field_after = sim->field;
-        if (sim_op) {
-            sim->current_step->op_field_after = sim_op->field;
-        }
+        StepResult &step = sim->writableStep();
+        step.field_after = snapshot;
+        step.op_field_after = op_field;
     }
 
     sim->rot_fail_count = 0;
-    sim->is_over = sim->field->isGameOver();
-
-    sim->current_step = std::make_shared<StepResult>(*sim->field);
-    if (sim_op) {
-        sim->current_step->op_field_before = sim_op->field;
+    sim->is_over = field->isGameOver();
+    if (sim->recorder) {
+        sim->recorder->endTurn(sim->frame_count);
+        if (sim->is_over) {
+            sim->recorder->finish();
+        }
     }
 
+    sim->current_step = std::make_shared<StepResult>(snapshot);
+    sim->current_step_shared = false;
+    sim->current_step->op_field_before = op_field;
+
     sim->step_count++;
 }
 
-std::unique_ptr<GameSim::Phase> GameSim::FreePhase::step() {
-    // bool go_fall = false;
-    // std::lock_guard lock(sim->field_m);
-    auto current_pair = sim->field->getNext(0);
-    current_pair.y -= FALL_SPEED / 60;
-    auto [yb, yt] = sim->field->getNextHeight(current_pair);
-    if (yb < current_pair.bottomY() && yt < current_pair.topY()) {
+bool GameSim::FreePhase::fallPair(const FieldState3 &field, PuyoPair &pp,
+                                   int &put_t) {
+    pp.y -= FALL_SPEED / 60;
+    auto [yb, yt] = field.getNextHeight(pp);
+    if (yb < pp.bottomY() && yt < pp.topY()) {
         put_t = PUT_T;
-        sim->field->updateNext(current_pair);
-    } else {
-        put_t--;
-        current_pair.y = yb;
-        if (yt > current_pair.topY()) {
-            current_pair.y += yt - current_pair.topY();
-        }
-        sim->field->updateNext(current_pair);
-        if (put_t < 0) {
-            sim->soft_put_target = std::nullopt;
-            sim->field->putNext();
-            // go_fall = true;
-            return std::make_unique<GameSim::FallPhase>(sim);
+        return false;
+    }
+    put_t--;
+    pp.y = yb;
+    if (yt > pp.topY()) {
+        pp.y += yt - pp.topY();
+    }
+    return put_t < 0;
+}
+GameSim::Phase::PhaseEnum GameSim::FreePhase::step() {
+    auto field = sim->field.lock();
+    auto current_pair = field->getNext(0);
+    bool put = fallPair(*field, current_pair, put_t);
+    field->updateNext(current_pair);
+    if (put) {
+        sim->soft_put_target = std::nullopt;
+        if (sim->recorder) {
+            sim->recorder->put(current_pair);
         }
+        field->putNext();
+        return PhaseEnum::fall;
     }
-    // if (go_fall) {
-    // } else {
-    return nullptr;
-    // }
+    return PhaseEnum::none;
 }
 
 GameSim::FallPhase::FallPhase(GameSim *sim)
-    : Phase(sim), current_chain(0), fall_wait_t(0), display_field(*sim->field) {
-    // std::shared_lock lock(sim->field_m);
-    if (sim->field->fall()) {
-        fall_wait_t = FALL_T;
+    : Phase(sim), chain_t(CHAIN_T + FALL_T), current_chain(0), fall_wait_t(0),
+      display_field() {
+    std::optional<FieldState3> display;
+    {
+        auto field = sim->field.lock();
+        if (!sim->headless) {
+            display = field->detached();
+        }
+        if (field->fall()) {
+            fall_wait_t = FALL_T;
+        }
+        assert(sim->current_step);
+        sim->writableStep().chains = field->deleteChainRecurse();
+    }
+    if (display) {
+        display->fall();
+        display_field = FieldSnapshot(*display);
     }
-    assert(sim->current_step);
-    sim->current_step->chains = sim->field->deleteChainRecurse();
-    chain_t.assign(sim->current_step->chains.size(), CHAIN_T + FALL_T);
-    display_field.fall();
 
     auto sim_op = sim->opponent.lock();
     if (sim_op) {
-        sim->current_step->op_field_before = sim_op->field;
+        sim->writableStep().op_field_before = sim_op->field.snapshot();
+    }
+}
+int GameSim::FallPhase::idleFrames() const {
+    if (fall_wait_t > 0) {
+        return fall_wait_t;
+    }
+    std::size_t chain_num = sim->current_step->chains.size();
+    if (current_chain >= chain_num) {
+        return 0;
+    }
+    if (!display_field) {
+        // display_fieldがない (headless) ので、残りの連鎖の時間をすべて飛ばせる
+        return chain_t + static_cast<int>(chain_num - current_chain - 1) *
+                             (CHAIN_T + FALL_T);
+    }
+    // display_fieldを変更するフレーム (CHAIN_T + FALL_T, FALL_T) と
+    // 次の連鎖に移るフレーム (1) の手前まで
+    int t = chain_t;
+    if (t > FALL_T && t < FALL_T + CHAIN_T) {
+        return t - FALL_T;
+    }
+    if (t > 1 && t < FALL_T) {
+        return t - 1;
+    }
+    return 0;
+}
+void GameSim::FallPhase::skip(int n) {
+    assert(n <= idleFrames());
+    if (fall_wait_t > 0) {
+        fall_wait_t -= n;
+    } else if (n > 0) {
+        // step()をn回呼んだのと同じく、chain_tが0になるたびに次の連鎖に移る
+        constexpr int period = CHAIN_T + FALL_T;
+        int elapsed = period - chain_t + n;
+        current_chain += static_cast<std::size_t>(elapsed / period);
+        chain_t = period - elapsed % period;
     }
 }
-std::unique_ptr<GameSim::Phase> GameSim::FallPhase::step() {
+GameSim::Phase::PhaseEnum GameSim::FallPhase::step() {
     if (fall_wait_t > 0) {
         fall_wait_t--;
     } else {
         assert(sim->current_step);
         if (current_chain >= sim->current_step->chains.size()) {
-            return std::make_unique<GameSim::GarbagePhase>(sim);
+            return PhaseEnum::garbage;
         }
-        if (chain_t.at(current_chain) == FALL_T + CHAIN_T) {
-            display_field.deleteChain(current_chain + 1);
+        if (chain_t == FALL_T + CHAIN_T && display_field) {
+            auto display = display_field.copy();
+            display->deleteChain(current_chain + 1);
+            display_field = FieldSnapshot(*display);
         }
-        if (chain_t.at(current_chain) == FALL_T) {
-            display_field.fall();
+        if (chain_t == FALL_T && display_field) {
+            auto display = display_field.copy();
+            display->fall();
+            display_field = FieldSnapshot(*display);
         }
-        if (--chain_t.at(current_chain) <= 0) {
+        if (--chain_t <= 0) {
             current_chain++;
+            chain_t = CHAIN_T + FALL_T;
         }
     }
-    return nullptr;
+    return PhaseEnum::none;
+}
+
+void GameSim::PhaseHolder::emplace(Phase::PhaseEnum kind, GameSim *sim) {
+    switch (kind) {
+    case Phase::free:
+        state.emplace<FreePhase>(sim);
+        break;
+    case Phase::fall:
+        state.emplace<FallPhase>(sim);
+        break;
+    case Phase::garbage:
+        state.emplace<GarbagePhase>(sim);
+        break;
+    case Phase::none:
+        reset();
+        break;
+    }
+}
+void GameSim::PhaseHolder::step() {
+    GameSim *sim = nullptr;
+    // step()の中で自分を置き換えないよう、次のフェーズは戻ってから作る
+    Phase::PhaseEnum next = std::visit(
+        [&sim](auto &p) -> Phase::PhaseEnum {
+            if constexpr (isNoPhase<decltype(p)>) {
+                return Phase::none;
+            } else {
+                sim = p.sim;
+                return p.step();
+            }
+        },
+        state);
+    if (next != Phase::none) {
+        emplace(next, sim);
+    }
+}
+int GameSim::PhaseHolder::idleFrames() const {
+    return std::visit(
+        [](const auto &p) -> int {
+            if constexpr (isNoPhase<decltype(p)>) {
+                return 0;
+            } else {
+                return p.idleFrames();
+            }
+        },
+        state);
+}
+void GameSim::PhaseHolder::rebind(GameSim *sim) {
+    std::visit(
+        [sim](auto &p) {
+            if constexpr (!isNoPhase<decltype(p)>) {
+                p.sim = sim;
+            }
+        },
+        state);
+}
+void GameSim::PhaseHolder::skip(int n) {
+    std::visit(
+        [n](auto &p) {
+            if constexpr (isNoPhase<decltype(p)>) {
+                assert(n == 0);
+            } else {
+                p.skip(n);
+            }
+        },
+        state);
 }
 
 } // namespace PUMILA_NS
@@ -0,0 +1,257 @@
+#include <algorithm>
+#include <cassert>
+#include <istream>
+#include <numeric>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <pumila/game_record.h>
+
+namespace PUMILA_NS {
+static constexpr std::uint8_t MAGIC[2] = {'P', 'R'};
+static constexpr std::uint8_t ACTION_MASK = 0x1f;
+static constexpr std::uint8_t HAS_CHAINS = 0x20;
+static constexpr std::uint8_t HAS_SEND = 0x40;
+static constexpr std::uint8_t HAS_RECV = 0x80;
+
+static void writeVarint(std::ostream &os, std::uint64_t v) {
+    while (v >= 0x80) {
+        os.put(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    os.put(static_cast<char>(v));
+}
+static std::uint8_t readByte(std::istream &is) {
+    int c = is.get();
+    if (c == std::char_traits<char>::eof()) {
+        throw std::runtime_error("GameRecord: unexpected end of stream");
+    }
+    return static_cast<std::uint8_t>(c);
+}
+static std::uint64_t readVarint(std::istream &is) {
+    std::uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        std::uint8_t b = readByte(is);
+        v |= static_cast<std::uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return v;
+        }
+    }
+    throw std::runtime_error("GameRecord: varint too long");
+}
+static std::uint64_t zigzag(std::int64_t v) {
+    return (static_cast<std::uint64_t>(v) << 1) ^
+           static_cast<std::uint64_t>(v >> 63);
+}
+static std::int64_t unzigzag(std::uint64_t v) {
+    return static_cast<std::int64_t>(v >> 1) ^
+           -static_cast<std::int64_t>(v & 1);
+}
+
+static void writeHeader(std::ostream &os, std::uint64_t seed) {
+    os.put(static_cast<char>(MAGIC[0]));
+    os.put(static_cast<char>(MAGIC[1]));
+    os.put(static_cast<char>(GameRecord::VERSION));
+    writeVarint(os, seed);
+}
+/*!
+ * \brief 1ターン分を書く (framesは前のターンとの差にする)
+ */
+static void writeTurn(std::ostream &os, const GameRecord::Turn &turn,
+                      int last_frames) {
+    assert(turn.action < ACTIONS_NUM);
+    std::uint8_t head = turn.action;
+    if (turn.chains > 0) {
+        head |= HAS_CHAINS;
+    }
+    if (turn.garbage_send > 0) {
+        head |= HAS_SEND;
+    }
+    if (turn.garbage_recv > 0) {
+        head |= HAS_RECV;
+    }
+    os.put(static_cast<char>(head));
+    if (turn.chains > 0) {
+        writeVarint(os, turn.chains);
+    }
+    if (turn.garbage_send > 0) {
+        writeVarint(os, turn.garbage_send);
+    }
+    if (turn.garbage_recv > 0) {
+        writeVarint(os, turn.garbage_recv);
+    }
+    writeVarint(os, zigzag(static_cast<std::int64_t>(turn.frames) -
+                           static_cast<std::int64_t>(last_frames)));
+}
+
+void GameRecord::write(std::ostream &os) const {
+    writeHeader(os, seed);
+    int last_frames = 0;
+    for (const auto &turn : turns) {
+        writeTurn(os, turn, last_frames);
+        last_frames = turn.frames;
+    }
+    os.put(static_cast<char>(END));
+}
+
+std::optional<GameRecord> GameRecord::read(std::istream &is) {
+    if (is.peek() == std::char_traits<char>::eof()) {
+        return std::nullopt;
+    }
+    if (readByte(is) != MAGIC[0] || readByte(is) != MAGIC[1]) {
+        throw std::runtime_error("GameRecord: bad magic");
+    }
+    std::uint8_t version = readByte(is);
+    if (version != VERSION) {
+        throw std::runtime_error("GameRecord: unsupported version " +
+                                 std::to_string(version));
+    }
+    GameRecord record;
+    record.seed = readVarint(is);
+    int last_frames = 0;
+    while (true) {
+        std::uint8_t head = readByte(is);
+        if (head == END) {
+            return record;
+        }
+        Turn turn;
+        turn.action = head & ACTION_MASK;
+        if (turn.action >= ACTIONS_NUM) {
+            throw std::runtime_error("GameRecord: bad action " +
+                                     std::to_string(turn.action));
+        }
+        if (head & HAS_CHAINS) {
+            turn.chains = readVarint(is);
+        }
+        if (head & HAS_SEND) {
+            turn.garbage_send = readVarint(is);
+        }
+        if (head & HAS_RECV) {
+            turn.garbage_recv = readVarint(is);
+        }
+        turn.frames = static_cast<int>(last_frames + unzigzag(readVarint(is)));
+        last_frames = turn.frames;
+        record.turns.push_back(turn);
+    }
+}
+
+GameRecordWriter::GameRecordWriter(std::ostream &os) : own_os(), os(&os) {}
+GameRecordWriter::GameRecordWriter()
+    : own_os(std::make_unique<std::ostringstream>()), os(own_os.get()) {}
+GameRecordWriter::~GameRecordWriter() = default;
+
+void GameRecordWriter::begin(std::uint64_t seed, int frame) {
+    finish();
+    writeHeader(*os, seed);
+    recording = true;
+    pending = std::nullopt;
+    turn_start = frame;
+    last_frames = 0;
+    garbage_ready = 0;
+}
+void GameRecordWriter::put(const Action &action) {
+    if (!recording) {
+        return;
+    }
+    auto it = std::find(actions.begin(), actions.end(), action);
+    assert(it != actions.end());
+    pending.emplace();
+    pending->action = static_cast<std::uint8_t>(it - actions.begin());
+}
+void GameRecordWriter::garbage(std::size_t chains, std::size_t garbage_send,
+                               std::size_t ready_before,
+                               std::size_t ready_after) {
+    if (!recording || !pending) {
+        return;
+    }
+    pending->chains = chains;
+    pending->garbage_send = garbage_send;
+    // 自分のおじゃまは相殺と落下でしか減らないので、増えた分が送られてきた分
+    assert(ready_before >= garbage_ready);
+    pending->garbage_recv = ready_before - garbage_ready;
+    garbage_ready = ready_after;
+}
+void GameRecordWriter::endTurn(int frame) {
+    if (!recording || !pending) {
+        return;
+    }
+    pending->frames = frame - turn_start;
+    writeTurn(*os, *pending, last_frames);
+    last_frames = pending->frames;
+    turn_start = frame;
+    pending = std::nullopt;
+    turn_num++;
+}
+void GameRecordWriter::finish() {
+    if (!recording) {
+        return;
+    }
+    os->put(static_cast<char>(GameRecord::END));
+    os->flush();
+    recording = false;
+    pending = std::nullopt;
+    game_num++;
+}
+std::string GameRecordWriter::data() const {
+    if (!own_os) {
+        return "";
+    }
+    return static_cast<const std::ostringstream &>(*own_os).str();
+}
+
+GameReplayer::GameReplayer(GameRecord record)
+    : rec(std::move(record)), current(), turn_index(0), frame_num(0) {
+    reset();
+}
+void GameReplayer::reset() {
+    current = FieldState3(static_cast<std::uint_fast32_t>(rec.seed));
+    turn_index = 0;
+    frame_num = 0;
+}
+std::vector<Chain> GameReplayer::step() {
+    if (done()) {
+        throw std::out_of_range("GameReplayer: no more turns");
+    }
+    const auto &turn = rec.turns[turn_index];
+    // FreePhase::step()
+    current.updateNext({current.getNext(0), actions[turn.action]});
+    current.putNext();
+    // FallPhase
+    current.fall();
+    std::vector<Chain> chains = current.deleteChainRecurse();
+    // GarbagePhase
+    std::size_t garbage_send = current.calcGarbage(std::accumulate(
+        chains.cbegin(), chains.cend(), 0,
+        [](int acc, const Chain &chain) { return acc + chain.score(); }));
+    if (chains.size() != turn.chains || garbage_send != turn.garbage_send) {
+        throw std::runtime_error(
+            "GameReplayer: turn " + std::to_string(turn_index) +
+            " does not match the record (chains " +
+            std::to_string(chains.size()) + " vs " +
+            std::to_string(turn.chains) + ", garbage " +
+            std::to_string(garbage_send) + " vs " +
+            std::to_string(turn.garbage_send) + ")");
+    }
+    current.addGarbage(turn.garbage_recv);
+    current.cancelGarbage(garbage_send);
+    if (current.getGarbageNumTotal() > 0) {
+        current.putGarbage();
+    }
+    turn_index++;
+    frame_num += turn.frames;
+    return chains;
+}
+void GameReplayer::seek(std::size_t turn) {
+    if (turn > rec.turns.size()) {
+        throw std::out_of_range("GameReplayer: turn " + std::to_string(turn) +
+                                " is out of range");
+    }
+    if (turn < turn_index) {
+        reset();
+    }
+    while (turn_index < turn) {
+        step();
+    }
+}
+} // namespace PUMILA_NS
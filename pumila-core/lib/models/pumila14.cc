@@ -1,66 +1,145 @@
+#include <algorithm>
+#include <cassert>
 #include <cstddef>
+#include <numeric>
 #include <pumila/action.h>
+#include <pumila/chain_all_cache.h>
 #include <pumila/models/pumila14.h>
 #include <pumila/models/common.h>
 
 namespace PUMILA_NS {
-void calcActionEach(Pumila14::InFeature *feat, FieldState3 field_copy, int a) {
+/*!
+ * \brief 連続するステップでは似た盤面についてcalcChainAllすることが多い
+ */
+static ChainAllCache chain_all_cache;
+
+Pumila14::FeatureRow Pumila14::FeatureRow::calc(const FieldState3 &field,
+                                                 int a) {
+    FieldState3 field_copy = field;
     field_copy.updateNext({field_copy.getNext(0), actions[a]});
-    bool action_in_field = field_copy.putNext();
-    auto chains = field_copy.deleteChainRecurse();
+    field_copy.putNext();
+    ChainSummary summary = field_copy.deleteChainSummary();
 
-    // feat->bias = 1;
-    auto chain_all = field_copy.calcChainAll();
-    for (std::size_t y = 0; y < FieldState3::HEIGHT; y++) {
+    FeatureRow row = {};
+    auto chain_all = chain_all_cache.calcChainAll(field_copy.getBoard());
+    const auto &heights = field_copy.heights();
+    // 一番高い列より上は空なので調べなくてよい
+    std::size_t top = *std::max_element(heights.begin(), heights.end());
+    for (std::size_t y = 0; y < top; y++) {
         for (std::size_t x = 0; x < FieldState3::WIDTH; x++) {
-            int p;
-            switch (field_copy.get(x, y)) {
-            case Puyo::red:
-                p = 0;
-                break;
-            case Puyo::blue:
-                p = 1;
-                break;
-            case Puyo::green:
-                p = 2;
-                break;
-            case Puyo::yellow:
-                p = 3;
-                break;
-            default:
-                p = -1;
-                break;
-            }
-            if (p >= 0) {
-                feat->field_colors[(y * FieldState3::WIDTH + x) * 4 + p] = 1;
-                feat->field_chains[(y * FieldState3::WIDTH + x) * 4 + p] =
-                    chain_all[y][x];
+            Puyo p = field_copy.get(x, y);
+            if (p >= Puyo::red && p <= Puyo::yellow) {
+                row.colors[y * FieldState3::WIDTH + x] =
+                    static_cast<std::uint8_t>(p);
+                row.chains[y * FieldState3::WIDTH + x] =
+                    static_cast<std::uint8_t>(chain_all[y][x]);
             }
         }
     }
+    row.chain_num = static_cast<std::uint8_t>(summary.chain_num);
+    row.scores = summary.scores;
+    return row;
+}
+void Pumila14::FeatureRow::expand(InFeature *feat) const {
+    // feat->bias = 1;
+    for (std::size_t i = 0; i < CELL_NUM; i++) {
+        if (colors[i]) {
+            int p = colors[i] - static_cast<int>(Puyo::red);
+            feat->field_colors[i * 4 + p] = 1;
+            feat->field_chains[i * 4 + p] = chains[i];
+        }
+    }
     for (std::size_t i = 0;
-         i < chains.size() && i < sizeof(feat->score_diff) / sizeof(double);
+         i < static_cast<std::size_t>(chain_num) &&
+         i < sizeof(feat->score_diff) / sizeof(double);
          i++) {
         double score_base = 40.0 * Chain::chainBonus(i + 1);
-        feat->score_diff[i] =
-            chains[i].score() / (score_base ? score_base : 40.0);
+        feat->score_diff[i] = scores[i] / (score_base ? score_base : 40.0);
     }
 }
 
+Pumila14::FeatureCache::FeatureCache(std::size_t capacity) : cache(capacity) {}
+Pumila14::FeatureCache::Key::Key(const FieldState3 &field, int a)
+    : board(field.getBoard()), bottom(field.getNext(0).bottom),
+      top(field.getNext(0).top), action(a) {}
+std::uint64_t Pumila14::FeatureCache::Key::hash() const {
+    std::uint64_t key = (static_cast<std::uint64_t>(bottom) << 8) |
+                        (static_cast<std::uint64_t>(top) << 5) |
+                        static_cast<std::uint64_t>(action);
+    std::uint64_t h = board.hash() ^ (key * 0x9e3779b97f4a7c15ull);
+    return h ^ (h >> 29);
+}
+bool Pumila14::FeatureCache::find(const FieldState3 &field, int a,
+                                  FeatureRow &row) {
+    Key key(field, a);
+    return cache.find(key.hash(), key, row);
+}
+void Pumila14::FeatureCache::store(const FieldState3 &field, int a,
+                                   const FeatureRow &row) {
+    Key key(field, a);
+    cache.store(key.hash(), key, row);
+}
+Pumila14::FeatureCache &Pumila14::featureCache() {
+    static FeatureCache cache;
+    return cache;
+}
+
 Matrix Pumila14::calcAction(const StepResult &result) {
     Matrix m(ACTIONS_NUM, FEATURE_NUM);
+    const FieldState3 &field = *result.field_before;
+    FeatureCache &cache = featureCache();
+    auto groups = field.placementGroups();
     std::array<std::future<void>, ACTIONS_NUM> tasks;
     for (int a = 0; a < ACTIONS_NUM; a++) {
+        if (groups[a] != a) {
+            // 置けないactionの行は0のまま、同じ盤面になるものは後でコピーする
+            continue;
+        }
         auto m_ptr = m.rowPtr<InFeature>(a);
-        tasks[a] = pool.submit_task([m_ptr, &result, a] {
-            calcActionEach(m_ptr, result.field_before, a);
+        FeatureRow row;
+        if (cache.find(field, a, row)) {
+            row.expand(m_ptr);
+            continue;
+        }
+        // キャッシュにないものだけスレッドプールで計算する
+        tasks[a] = pool.submit_task([m_ptr, &field, &cache, a] {
+            FeatureRow row = FeatureRow::calc(field, a);
+            cache.store(field, a, row);
+            row.expand(m_ptr);
         });
     }
     for (int a = 0; a < ACTIONS_NUM; a++) {
-        tasks[a].get();
+        if (tasks[a].valid()) {
+            tasks[a].get();
+        }
+    }
+    for (int a = 0; a < ACTIONS_NUM; a++) {
+        if (groups[a] >= 0 && groups[a] != a) {
+            *m.rowPtr<InFeature>(a) = *m.rowPtr<InFeature>(groups[a]);
+        }
     }
     return m;
 }
+void Pumila14::calcActionTo(const FieldState3 &field, InFeature *rows) {
+    FeatureCache &cache = featureCache();
+    auto groups = field.placementGroups();
+    for (int a = 0; a < ACTIONS_NUM; a++) {
+        if (groups[a] < 0) {
+            continue;
+        }
+        if (groups[a] != a) {
+            // groups[a] < aなので計算済み
+            rows[a] = rows[groups[a]];
+            continue;
+        }
+        FeatureRow row;
+        if (!cache.find(field, a, row)) {
+            row = FeatureRow::calc(field, a);
+            cache.store(field, a, row);
+        }
+        row.expand(rows + a);
+    }
+}
 
 Matrix Pumila14::rotateColor(const Matrix &in) {
     assert(in.cols() == sizeof(InFeature) / sizeof(double) &&
@@ -0,0 +1,221 @@
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <tuple>
+#include <unordered_map>
+#include <pumila/game.h>
+#include <pumila/soft_put_planner.h>
+
+namespace PUMILA_NS {
+namespace {
+struct Node {
+    PuyoPair pp;
+    int put_t;
+    int cooldown;
+    int rot_fail;
+    int rot_fail_count;
+    int frames;
+    std::size_t parent;
+    SoftPutPlanner::Frame frame;
+    /*!
+     * \brief 目標の位置に置いた (探索の終わり)
+     */
+    bool goal;
+};
+std::uint64_t stateKey(const Node &node) {
+    std::uint64_t y_ticks = static_cast<std::uint64_t>(
+        std::lround(node.pp.y * SoftPutPlanner::Y_TICKS) +
+        SoftPutPlanner::Y_TICKS);
+    return static_cast<std::uint64_t>(node.pp.x + 1) |
+           (static_cast<std::uint64_t>(node.pp.rot) << 4) | (y_ticks << 6) |
+           (static_cast<std::uint64_t>(node.put_t + 16) << 24) |
+           (static_cast<std::uint64_t>(node.rot_fail + 2) << 32) |
+           (static_cast<std::uint64_t>(node.rot_fail_count) << 35) |
+           (static_cast<std::uint64_t>(node.cooldown) << 40);
+}
+} // namespace
+
+std::optional<SoftPutPlanner::Plan>
+SoftPutPlanner::search(const FieldState3 &field, const PuyoPair &pp,
+                       int put_t, int cooldown, int rot_fail,
+                       int rot_fail_count, const Action &target,
+                       int interval) {
+    using FreePhase = GameSim::FreePhase;
+    interval = std::max(interval, 1);
+
+    // 置くまでの残りフレーム数の下限 (A*のヒューリスティック):
+    // 目標の位置の高さまでsoftDropし続けて落ち、接地後もsoftDropし続ける
+    PuyoPair target_pp(pp, target);
+    {
+        auto [yb, yt] = field.getNextHeight(target);
+        target_pp.y = yb;
+        if (yt > target_pp.topY()) {
+            target_pp.y += yt - target_pp.topY();
+        }
+    }
+    constexpr double drop_speed =
+        (FreePhase::SOFT_SPEED + FreePhase::FALL_SPEED) / 60;
+    constexpr int lock_speed = 11; // softDrop 10 + 1
+    // 接地したフレームでput_tはPUT_T - lock_speed以下になっている
+    constexpr int landed_frames = FreePhase::PUT_T / lock_speed;
+    auto remaining = [&](const PuyoPair &p, int t) {
+        if (t < FreePhase::PUT_T) {
+            return (t + lock_speed) / lock_speed;
+        }
+        int fall = static_cast<int>(
+            std::ceil((p.y - target_pp.y) / drop_speed - 1e-9));
+        return std::max(fall, 1) + landed_frames;
+    };
+
+    std::vector<Node> nodes;
+    std::unordered_map<std::uint64_t, int> best_frames;
+    // (推定総フレーム数, -フレーム数, index) の小さい順
+    using Item = std::tuple<int, int, std::size_t>;
+    std::priority_queue<Item, std::vector<Item>, std::greater<>> queue;
+    nodes.push_back({pp, put_t, std::max(cooldown, 0), rot_fail,
+                     rot_fail_count, 0, 0, Frame{}, false});
+    best_frames[stateKey(nodes[0])] = 0;
+    queue.emplace(remaining(pp, put_t), 0, 0);
+
+    while (!queue.empty()) {
+        std::size_t i = std::get<2>(queue.top());
+        queue.pop();
+        const Node cur = nodes[i];
+        if (cur.goal) {
+            Plan plan;
+            for (std::size_t n = i; n != 0; n = nodes[n].parent) {
+                plan.push_back(nodes[n].frame);
+            }
+            std::reverse(plan.begin(), plan.end());
+            return plan;
+        }
+        if (best_frames[stateKey(cur)] < cur.frames) {
+            continue;
+        }
+        int frames = cur.frames + 1;
+        for (int rot : {0, 1, -1}) {
+            for (int dx : {0, 1, -1}) {
+                bool input = rot != 0 || dx != 0;
+                if (input && cur.cooldown > 0) {
+                    continue;
+                }
+                PuyoPair moved = cur.pp;
+                int next_rot_fail = cur.rot_fail;
+                int next_rot_fail_count = cur.rot_fail_count;
+                // 失敗した回転もクイックターンのために入力として残す
+                if (rot != 0 &&
+                    GameSim::applyRotPair(field, moved, rot, next_rot_fail,
+                                          next_rot_fail_count) == 0 &&
+                    next_rot_fail == cur.rot_fail &&
+                    next_rot_fail_count == cur.rot_fail_count) {
+                    continue;
+                }
+                if (dx != 0 && !GameSim::tryMovePair(field, moved, dx)) {
+                    continue;
+                }
+                for (bool soft : {true, false}) {
+                    Node next{moved,
+                              cur.put_t,
+                              input ? interval - 1
+                                    : std::max(cur.cooldown - 1, 0),
+                              next_rot_fail,
+                              next_rot_fail_count,
+                              frames,
+                              i,
+                              Frame{},
+                              false};
+                    if (soft) {
+                        next.pp.y -= FreePhase::SOFT_SPEED / 60;
+                        next.put_t -= 10;
+                    }
+                    bool put = FreePhase::fallPair(field, next.pp, next.put_t);
+                    next.frame = Frame{
+                        static_cast<std::int8_t>(rot),
+                        static_cast<std::int8_t>(dx),
+                        soft,
+                        next.pp.x,
+                        next.pp.rot,
+                        static_cast<int>(std::lround(next.pp.y * Y_TICKS)),
+                        next.put_t,
+                        next.rot_fail,
+                        next.rot_fail_count};
+                    if (put) {
+                        if (static_cast<Action>(next.pp) == target) {
+                            next.goal = true;
+                            nodes.push_back(next);
+                            queue.emplace(frames, -frames, nodes.size() - 1);
+                        }
+                        continue;
+                    }
+                    auto key = stateKey(next);
+                    auto it = best_frames.find(key);
+                    if (it != best_frames.end() && it->second <= frames) {
+                        continue;
+                    }
+                    best_frames[key] = frames;
+                    nodes.push_back(next);
+                    queue.emplace(frames + remaining(next.pp, next.put_t),
+                                  -frames, nodes.size() - 1);
+                }
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+SoftPutPlanner::SoftPutPlanner(std::size_t capacity) : cache(capacity) {}
+
+std::shared_ptr<const SoftPutPlanner::Plan>
+SoftPutPlanner::plan(const FieldState3 &field, const PuyoPair &pp, int put_t,
+                     int cooldown, int rot_fail, int rot_fail_count,
+                     const Action &target, int interval) {
+    int y_ticks = static_cast<int>(std::lround(pp.y * Y_TICKS));
+    if (y_ticks < 0 || y_ticks >= 2048 || put_t < -1 || put_t > 126 ||
+        cooldown < 0 || cooldown >= 32 || interval < 1 || interval > 32 ||
+        rot_fail < -2 || rot_fail > 2 || rot_fail_count < 0 ||
+        rot_fail_count >= 16) {
+        // キーに収まらないのでキャッシュしない
+        auto result = search(field, pp, put_t, cooldown, rot_fail,
+                             rot_fail_count, target, interval);
+        return result ? std::make_shared<const Plan>(std::move(*result))
+                      : nullptr;
+    }
+    // 高さ (4bit x 6列) と開始状態、目標をすべてキーに詰める
+    std::array<std::uint64_t, 2> key = {};
+    for (std::size_t x = 0; x < FieldState3::WIDTH; x++) {
+        key[0] |= static_cast<std::uint64_t>(field.getHeight(x)) << (x * 4);
+    }
+    key[0] |= static_cast<std::uint64_t>(pp.x + 1) << 24;
+    key[0] |= static_cast<std::uint64_t>(pp.rot) << 27;
+    key[0] |= static_cast<std::uint64_t>(y_ticks) << 29;
+    key[0] |= static_cast<std::uint64_t>(put_t + 1) << 40;
+    key[0] |= static_cast<std::uint64_t>(cooldown) << 47;
+    key[0] |= static_cast<std::uint64_t>(interval - 1) << 52;
+    key[0] |= static_cast<std::uint64_t>(target.x) << 57;
+    key[0] |= static_cast<std::uint64_t>(target.rot) << 60;
+    key[1] = static_cast<std::uint64_t>(rot_fail + 2) |
+             (static_cast<std::uint64_t>(rot_fail_count) << 3);
+
+    // 目標は上位bitにあるので、全bitを混ぜてから剰余を取る
+    std::uint64_t h = key[0] ^ (key[1] * 0x9e3779b97f4a7c15ull);
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+    h ^= h >> 31;
+    std::shared_ptr<const Plan> plan;
+    if (cache.find(h, key, plan)) {
+        return plan;
+    }
+    auto result = search(field, pp, put_t, cooldown, rot_fail, rot_fail_count,
+                         target, interval);
+    if (result) {
+        plan = std::make_shared<const Plan>(std::move(*result));
+    }
+    cache.store(h, key, plan);
+    return plan;
+}
+
+SoftPutPlanner &SoftPutPlanner::shared() {
+    static SoftPutPlanner planner;
+    return planner;
+}
+} // namespace PUMILA_NS
@@ -0,0 +1,48 @@
+#include <pumila/tsumo.h>
+#include <pumila/philox.h>
+#include <map>
+#include <mutex>
+
+namespace PUMILA_NS {
+Tsumo::Tsumo(std::uint_fast32_t seed) : seed_(seed), pairs() {
+    PhiloxEngine rnd(seed, STREAM);
+    auto next_color = [&rnd] {
+        switch (rnd.uniform(4)) {
+        case 0:
+            return Puyo::red;
+        case 1:
+            return Puyo::blue;
+        case 2:
+            return Puyo::green;
+        case 3:
+        default:
+            return Puyo::yellow;
+        }
+    };
+    for (auto &p : pairs) {
+        p.first = next_color();
+        p.second = next_color();
+    }
+}
+
+std::shared_ptr<const Tsumo> Tsumo::share(std::uint_fast32_t seed) {
+    static std::mutex mtx;
+    static std::map<std::uint_fast32_t, std::weak_ptr<const Tsumo>> shared;
+    std::lock_guard lock(mtx);
+    auto &weak = shared[seed];
+    auto tsumo = weak.lock();
+    if (!tsumo) {
+        // 使われなくなったものを掃除
+        for (auto it = shared.begin(); it != shared.end();) {
+            if (it->second.expired() && it->first != seed) {
+                it = shared.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        tsumo = std::make_shared<const Tsumo>(seed);
+        weak = tsumo;
+    }
+    return tsumo;
+}
+} // namespace PUMILA_NS
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <future>
+#include <stdexcept>
+#include <string>
+#include <pumila/action.h>
+#include <pumila/models/common.h>
+#include <pumila/vec_game.h>
+
+namespace PUMILA_NS {
+/*!
+ * \brief f(0)〜f(env_num - 1)をスレッドプールで並列に実行し、終わるまで待つ
+ */
+template <typename F>
+static void forEachEnv(std::size_t env_num, const F &f) {
+    std::vector<std::future<void>> tasks;
+    tasks.reserve(env_num);
+    for (std::size_t env = 0; env < env_num; env++) {
+        tasks.push_back(pool.submit_task([&f, env] { f(env); }));
+    }
+    for (auto &task : tasks) {
+        task.get();
+    }
+}
+
+VecGameSim::VecGameSim(std::size_t env_num, bool versus, std::uint64_t seed,
+                       bool enable_garbage)
+    : versus(versus), enable_garbage(enable_garbage), sims(), rnds(),
+      last_score(), obs(env_num * (versus ? 2 : 1) * ACTIONS_NUM,
+                        Pumila14::FEATURE_NUM),
+      reward_buf(), done_buf(), needs_action_buf(), legal_buf() {
+    for (std::size_t i = 0; i < env_num * players(); i++) {
+        sims.push_back(std::make_shared<GameSim>(0, enable_garbage));
+        sims[i]->headless = true;
+        if (versus && i % 2 == 1) {
+            sims[i - 1]->setOpponentSim(sims[i]);
+        }
+    }
+    last_score.assign(agentNum(), 0);
+    reward_buf.assign(agentNum(), 0);
+    done_buf.assign(agentNum(), 0);
+    needs_action_buf.assign(agentNum(), 0);
+    legal_buf.assign(agentNum() * ACTIONS_NUM, 0);
+    reset(seed);
+}
+
+void VecGameSim::reset(std::uint64_t seed) {
+    rnds.clear();
+    for (std::size_t env = 0; env * players() < agentNum(); env++) {
+        rnds.emplace_back(seed, env);
+    }
+    forEachEnv(envNum(), [this](std::size_t env) {
+        resetEnv(env);
+        observeEnv(env);
+    });
+    std::fill(reward_buf.begin(), reward_buf.end(), 0);
+    std::fill(done_buf.begin(), done_buf.end(), 0);
+}
+
+void VecGameSim::resetEnv(std::size_t env) {
+    // 対戦の2人は同じ配ぷよを使う
+    auto seed = rnds[env]();
+    std::size_t begin = env * players();
+    for (std::size_t i = begin; i < begin + players(); i++) {
+        // 前のゲームのStepResultに新しいゲームのfieldが入らないようにする
+        sims[i]->current_step = nullptr;
+        sims[i]->reset(seed);
+        last_score[i] = 0;
+    }
+    if (versus) {
+        // 1人目のop_field_beforeはまだリセット前の相手のfieldになっている
+        sims[begin]->current_step->op_field_before =
+            sims[begin + 1]->field.snapshot();
+    }
+}
+
+void VecGameSim::observeEnv(std::size_t env) {
+    for (std::size_t i = env * players(); i < (env + 1) * players(); i++) {
+        auto rows = obs.rowPtr<Pumila14::InFeature>(i * ACTIONS_NUM);
+        std::fill_n(reinterpret_cast<double *>(rows),
+                    ACTIONS_NUM * Pumila14::FEATURE_NUM, 0.0);
+        needs_action_buf[i] = sims[i]->needsAction();
+        std::uint32_t legal = 0;
+        if (needs_action_buf[i]) {
+            const auto &field = *sims[i]->current_step->field_before;
+            Pumila14::calcActionTo(field, rows);
+            legal = field.legalActions();
+        }
+        for (int a = 0; a < ACTIONS_NUM; a++) {
+            legal_buf[i * ACTIONS_NUM + a] = legal >> a & 1;
+        }
+    }
+}
+
+void VecGameSim::stepEnv(std::size_t env, const int *action_index) {
+    std::size_t begin = env * players(), end = begin + players();
+    std::vector<std::shared_ptr<GameSim>> env_sims(sims.begin() + begin,
+                                                   sims.begin() + end);
+    for (std::size_t i = begin; i < end; i++) {
+        if (sims[i]->needsAction()) {
+            sims[i]->put(actions[action_index[i]]);
+        }
+    }
+    GameSim::fastForward(env_sims);
+
+    bool over = false;
+    for (std::size_t i = begin; i < end; i++) {
+        reward_buf[i] = 0;
+        if (sims[i]->needsAction()) {
+            int score = sims[i]->current_step->field_before->totalScore();
+            reward_buf[i] = score - last_score[i];
+            last_score[i] = score;
+        }
+        over = over || sims[i]->is_over;
+    }
+    for (std::size_t i = begin; i < end; i++) {
+        done_buf[i] = over;
+    }
+    if (over) {
+        resetEnv(env);
+    }
+    observeEnv(env);
+}
+
+void VecGameSim::step(const int *action_index) {
+    for (std::size_t i = 0; i < agentNum(); i++) {
+        if (sims[i]->needsAction() &&
+            (action_index[i] < 0 || action_index[i] >= ACTIONS_NUM)) {
+            throw std::out_of_range("VecGameSim::step: invalid action " +
+                                    std::to_string(action_index[i]) +
+                                    " for agent " + std::to_string(i));
+        }
+    }
+    forEachEnv(envNum(), [this, action_index](std::size_t env) {
+        stepEnv(env, action_index);
+    });
+}
+} // namespace PUMILA_NS
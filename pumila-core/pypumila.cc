@@ -2,8 +2,16 @@
 #include "pumila/step.h"
 #include <pumila/pumila.h>
 #include <pybind11/detail/common.h>
+#include <pybind11/functional.h>
+#include <pybind11/numpy.h>
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
 
 using namespace PUMILA_NS;
 namespace py = pybind11;
@@ -75,8 +83,14 @@ PYBIND11_MODULE(pypumila, m) {
         .def("set", &FieldState3::set)
         .def("get_next", &FieldState3::getNext)
         .def("update_next", &FieldState3::updateNext)
-        .def("add_garbage", &FieldState3::addGarbage)
+        .def("add_garbage",
+             py::overload_cast<const std::shared_ptr<GarbageGroup> &>(
+                 &FieldState3::addGarbage),
+             py::keep_alive<1, 2>())
+        .def("add_garbage",
+             py::overload_cast<std::size_t>(&FieldState3::addGarbage))
         .def("get_garbage_num_total", &FieldState3::getGarbageNumTotal)
+        .def("legal_actions", &FieldState3::legalActions)
         .def("calc_garbage", &FieldState3::calcGarbage)
         .def("cancel_garbage", &FieldState3::cancelGarbage)
         .def("get_next_height", py::overload_cast<const Action &>(
@@ -84,28 +98,73 @@ PYBIND11_MODULE(pypumila, m) {
         .def("get_next_height",
              py::overload_cast<>(&FieldState3::getNextHeight, py::const_))
         .def("get_height", &FieldState3::getHeight)
+        .def("heights", &FieldState3::heights)
         .def("put_next", &FieldState3::putNext)
         .def("delete_chain", &FieldState3::deleteChain)
         .def("fall", &FieldState3::fall)
-        .def("delete_chain_recurse", &FieldState3::deleteChainRecurse)
+        .def("delete_chain_recurse",
+             py::overload_cast<>(&FieldState3::deleteChainRecurse))
+        .def("delete_chain_summary", &FieldState3::deleteChainSummary)
         .def("calc_chain_all", &FieldState3::calcChainAll)
         .def("total_score", &FieldState3::totalScore)
-        .def("is_game_over", &FieldState3::isGameOver);
+        .def("is_game_over", &FieldState3::isGameOver)
+        .def("pack",
+             [](const FieldState3 &f) {
+                 auto packed = f.pack();
+                 return py::bytes(reinterpret_cast<const char *>(&packed),
+                                  sizeof(packed));
+             })
+        .def_static("unpack",
+                    [](const py::bytes &b) {
+                        std::string s = b;
+                        if (s.size() != sizeof(FieldState3::Packed)) {
+                            throw py::value_error("invalid packed size");
+                        }
+                        FieldState3::Packed packed;
+                        std::memcpy(&packed, s.data(), sizeof(packed));
+                        return FieldState3::unpack(packed);
+                    })
+        .def("hash", [](const FieldState3 &f) { return f.pack().hash(); });
     py::class_<Chain>(m, "Chain")
-        .def_readonly("connections", &Chain::connections)
+        .def_property_readonly("connections",
+                               [](const Chain &c) {
+                                   return std::vector<std::pair<Puyo, int>>(
+                                       c.connections.begin(),
+                                       c.connections.end());
+                               })
         .def_readonly("chain_num", &Chain::chain_num)
         .def("is_empty", &Chain::isEmpty)
         .def("connection_num", &Chain::connectionNum)
         .def("score", &Chain::score)
         .def("score_a", &Chain::scoreA)
         .def("score_b", &Chain::scoreB);
+    py::class_<ChainSummary>(m, "ChainSummary")
+        .def_readonly("chain_num", &ChainSummary::chain_num)
+        .def_property_readonly("scores",
+                               [](const ChainSummary &s) {
+                                   return std::vector<int>(
+                                       s.scores.begin(),
+                                       s.scores.begin() + s.chain_num);
+                               })
+        .def_readonly("total_score", &ChainSummary::total_score)
+        .def_readonly("connection_num", &ChainSummary::connection_num)
+        .def_readonly("garbage", &ChainSummary::garbage)
+        .def_readonly("all_clear", &ChainSummary::all_clear);
     py::class_<StepResult, std::shared_ptr<StepResult>>(m, "StepResult")
-        .def_readonly("field_before", &StepResult::field_before)
-        .def_readonly("field_after", &StepResult::field_after)
+        .def_property_readonly(
+            "field_before",
+            [](const StepResult &r) { return r.field_before.copy(); })
+        .def_property_readonly(
+            "field_after",
+            [](const StepResult &r) { return r.field_after.copy(); })
         .def_readonly("chains", &StepResult::chains)
         .def_readonly("garbage_send", &StepResult::garbage_send)
-        .def_readonly("op_field_before", &StepResult::op_field_before)
-        .def_readonly("op_field_after", &StepResult::op_field_after)
+        .def_property_readonly(
+            "op_field_before",
+            [](const StepResult &r) { return r.op_field_before.copy(); })
+        .def_property_readonly(
+            "op_field_after",
+            [](const StepResult &r) { return r.op_field_after.copy(); })
         .def_readonly("garbage_recv", &StepResult::garbage_recv)
         .def_readonly("garbage_fell_pos", &StepResult::garbage_fell_pos)
         .def("done", &StepResult::done)
@@ -114,12 +173,18 @@ PYBIND11_MODULE(pypumila, m) {
         py::class_<GameSim, std::shared_ptr<GameSim>>(m, "GameSim")
             .def(py::init<typename std::mt19937::result_type, bool>())
             .def(py::init<>())
-            .def("field_copy", [](const GameSim &sim) { return sim.field; })
+            .def("field_copy",
+                 [](const GameSim &sim) { return sim.field.copy(); })
             .def("current_step",
                  [](const GameSim &sim) { return sim.current_step; })
             .def_readwrite("enable_garbage", &GameSim::enable_garbage)
             .def_readwrite("is_over", &GameSim::is_over)
+            .def_readwrite("headless", &GameSim::headless)
             .def_readwrite("step_count", &GameSim::step_count)
+            .def_readwrite("frame_count", &GameSim::frame_count)
+            .def_readwrite("recorder", &GameSim::recorder)
+            .def("snapshot", &GameSim::snapshot)
+            .def("restore", &GameSim::restore)
             .def("set_opponent_sim", &GameSim::setOpponentSim)
             .def("move_pair", &GameSim::movePair)
             .def("rot_pair", &GameSim::rotPair)
@@ -129,6 +194,13 @@ PYBIND11_MODULE(pypumila, m) {
                  py::call_guard<py::gil_scoped_release>())
             .def("put", &GameSim::put)
             .def("soft_put", &GameSim::softPut)
+            .def("needs_action", &GameSim::needsAction)
+            .def_static("fast_forward", &GameSim::fastForward,
+                        py::arg("sims"),
+                        py::arg("max_frames") = std::numeric_limits<int>::max(),
+                        py::call_guard<py::gil_scoped_release>())
+            .def("put_turn", &GameSim::putTurn,
+                 py::call_guard<py::gil_scoped_release>())
             .def("reset", py::overload_cast<typename std::mt19937::result_type>(
                               &GameSim::reset))
             .def("reset", py::overload_cast<>(&GameSim::reset))
@@ -139,7 +211,7 @@ PYBIND11_MODULE(pypumila, m) {
             .def("fall_phase_current_chain",
                  [](const GameSim &sim) -> std::size_t {
                      auto fall_phase =
-                         dynamic_cast<GameSim::FallPhase *>(sim.phase.get());
+                         sim.phase.getIf<GameSim::FallPhase>();
                      if (fall_phase) {
                          return fall_phase->current_chain;
                      } else {
@@ -149,19 +221,156 @@ PYBIND11_MODULE(pypumila, m) {
             .def("fall_phase_display_field",
                  [](const GameSim &sim) -> std::optional<FieldState3> {
                      auto fall_phase =
-                         dynamic_cast<GameSim::FallPhase *>(sim.phase.get());
+                         sim.phase.getIf<GameSim::FallPhase>();
                      if (fall_phase) {
-                         return fall_phase->display_field;
+                         return fall_phase->display_field.copy();
                      } else {
                          return std::nullopt;
                      }
                  });
+    py::class_<GameSim::Snapshot>(game_sim, "Snapshot");
     py::enum_<GameSim::Phase::PhaseEnum>(game_sim, "PhaseEnum")
         .value("none", GameSim::Phase::none)
         .value("garbage", GameSim::Phase::garbage)
         .value("free", GameSim::Phase::free)
         .value("fall", GameSim::Phase::fall)
         .export_values();
+    auto arena =
+        py::class_<Arena>(m, "Arena")
+            // Pythonの関数もpolicyにできるが、呼ぶたびにGILを取る
+            .def(py::init<Arena::Policy, Arena::Policy>())
+            .def_static("random_policy", &Arena::randomPolicy)
+            .def_static("greedy_policy", &Arena::greedyPolicy)
+            .def_readwrite("enable_garbage", &Arena::enable_garbage)
+            .def_readwrite("max_frames", &Arena::max_frames)
+            .def_readwrite("record", &Arena::record)
+            .def("play_game", &Arena::playGame, py::arg("seed"),
+                 py::arg("stats") = nullptr,
+                 py::call_guard<py::gil_scoped_release>())
+            .def("run", &Arena::run, py::arg("games"), py::arg("seed"),
+                 py::call_guard<py::gil_scoped_release>());
+    py::class_<Arena::GameResult>(arena, "GameResult")
+        .def_readonly("winner", &Arena::GameResult::winner)
+        .def_readonly("frames", &Arena::GameResult::frames)
+        .def_readonly("score", &Arena::GameResult::score)
+        .def_readonly("steps", &Arena::GameResult::steps);
+    py::class_<Arena::Result>(arena, "Result")
+        .def(py::init<>())
+        .def_readonly("games", &Arena::Result::games)
+        .def_readonly("wins", &Arena::Result::wins)
+        .def_readonly("draws", &Arena::Result::draws)
+        .def_readonly("score_sum", &Arena::Result::score_sum)
+        .def_readonly("chain_hist", &Arena::Result::chain_hist)
+        .def_readonly("frames_sum", &Arena::Result::frames_sum)
+        .def_readonly("records", &Arena::Result::records);
+
+    auto game_record =
+        py::class_<GameRecord>(m, "GameRecord")
+            .def(py::init<>())
+            .def_readwrite("seed", &GameRecord::seed)
+            .def_readwrite("turns", &GameRecord::turns)
+            .def("encode",
+                 [](const GameRecord &record) {
+                     std::ostringstream os;
+                     record.write(os);
+                     return py::bytes(os.str());
+                 })
+            // 連結された複数の記録をすべて読む
+            .def_static("decode_all", [](const py::bytes &data) {
+                std::istringstream is(static_cast<std::string>(data));
+                std::vector<GameRecord> records;
+                while (auto record = GameRecord::read(is)) {
+                    records.push_back(std::move(*record));
+                }
+                return records;
+            });
+    py::class_<GameRecord::Turn>(game_record, "Turn")
+        .def(py::init<>())
+        .def_readwrite("action", &GameRecord::Turn::action)
+        .def_readwrite("frames", &GameRecord::Turn::frames)
+        .def_readwrite("chains", &GameRecord::Turn::chains)
+        .def_readwrite("garbage_send", &GameRecord::Turn::garbage_send)
+        .def_readwrite("garbage_recv", &GameRecord::Turn::garbage_recv);
+    py::class_<GameRecordWriter, std::shared_ptr<GameRecordWriter>>(
+        m, "GameRecordWriter")
+        .def(py::init<>())
+        .def("finish", &GameRecordWriter::finish)
+        .def("is_recording", &GameRecordWriter::isRecording)
+        .def("games", &GameRecordWriter::games)
+        .def("turns", &GameRecordWriter::turns)
+        .def("data", [](const GameRecordWriter &writer) {
+            return py::bytes(writer.data());
+        });
+    py::class_<GameReplayer>(m, "GameReplayer")
+        .def(py::init<GameRecord>())
+        .def("record", &GameReplayer::record)
+        .def("field", &GameReplayer::field)
+        .def("turn", &GameReplayer::turn)
+        .def("frame", &GameReplayer::frame)
+        .def("done", &GameReplayer::done)
+        .def("reset", &GameReplayer::reset)
+        .def("step", &GameReplayer::step)
+        .def("seek", &GameReplayer::seek,
+             py::call_guard<py::gil_scoped_release>());
+
+    // 結果はVecGameSimのバッファをそのまま指すので、次のstep()で上書きされる
+    auto vec_game_views = [](const py::object &self) {
+        const auto &vec = self.cast<const VecGameSim &>();
+        auto n = static_cast<py::ssize_t>(vec.agentNum());
+        return py::make_tuple(
+            py::array_t<double>(
+                {n, static_cast<py::ssize_t>(ACTIONS_NUM),
+                 static_cast<py::ssize_t>(Pumila14::FEATURE_NUM)},
+                vec.observations().ptr(), self),
+            py::array_t<double>(n, vec.rewards().data(), self),
+            py::array_t<bool>(
+                n, reinterpret_cast<const bool *>(vec.dones().data()), self),
+            py::array_t<bool>(
+                n, reinterpret_cast<const bool *>(vec.needsAction().data()),
+                self));
+    };
+    py::class_<VecGameSim, std::shared_ptr<VecGameSim>>(m, "VecGameSim")
+        .def(py::init<std::size_t, bool, std::uint64_t, bool>(),
+             py::arg("env_num"), py::arg("versus"), py::arg("seed"),
+             py::arg("enable_garbage") = true)
+        .def(py::init([](std::size_t env_num, bool versus) {
+                 return std::make_shared<VecGameSim>(env_num, versus,
+                                                     std::random_device()());
+             }),
+             py::arg("env_num"), py::arg("versus") = false)
+        .def("env_num", &VecGameSim::envNum)
+        .def("agent_num", &VecGameSim::agentNum)
+        .def("players", &VecGameSim::players)
+        .def("sim", &VecGameSim::sim)
+        .def("reset", &VecGameSim::reset,
+             py::call_guard<py::gil_scoped_release>())
+        .def("step",
+             [vec_game_views](const py::object &self,
+                              const py::array_t<int, py::array::c_style |
+                                                         py::array::forcecast>
+                                  &actions) {
+                 auto &vec = self.cast<VecGameSim &>();
+                 if (actions.ndim() != 1 ||
+                     static_cast<std::size_t>(actions.shape(0)) !=
+                         vec.agentNum()) {
+                     throw std::invalid_argument(
+                         "actions must be a 1-d array of agent_num() ints");
+                 }
+                 {
+                     py::gil_scoped_release release;
+                     vec.step(actions.data());
+                 }
+                 return vec_game_views(self);
+             })
+        .def("observe", vec_game_views)
+        .def("legal_actions", [](const py::object &self) {
+            const auto &vec = self.cast<const VecGameSim &>();
+            return py::array_t<bool>(
+                {static_cast<py::ssize_t>(vec.agentNum()),
+                 static_cast<py::ssize_t>(ACTIONS_NUM)},
+                reinterpret_cast<const bool *>(vec.legalActions().data()),
+                self);
+        });
     py::class_<Matrix>(m, "Matrix", py::buffer_protocol())
         .def_buffer([](Matrix &m) -> py::buffer_info {
             return py::buffer_info(m.ptr(), sizeof(double),
@@ -202,5 +411,19 @@ PYBIND11_MODULE(pypumila, m) {
         .def("rotate_color", &Pumila14::rotateColor,
              py::call_guard<py::gil_scoped_release>())
         .def("reward", &Pumila14::reward,
-             py::call_guard<py::gil_scoped_release>());
+             py::call_guard<py::gil_scoped_release>())
+        .def("legal_actions",
+             [](const StepResult &result) {
+                 std::uint32_t legal = Pumila14::legalActions(result);
+                 py::array_t<bool> mask(ACTIONS_NUM);
+                 for (int a = 0; a < ACTIONS_NUM; a++) {
+                     mask.mutable_at(a) = legal >> a & 1;
+                 }
+                 return mask;
+             })
+        .def("feature_cache_hits",
+             []() { return Pumila14::featureCache().hits(); })
+        .def("feature_cache_misses",
+             []() { return Pumila14::featureCache().misses(); })
+        .def("feature_cache_clear", []() { Pumila14::featureCache().clear(); });
 }
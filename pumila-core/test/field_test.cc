@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
+#include <limits>
 #include <memory>
+#include <random>
 #include <pumila/pumila.h>
 #include <stdexcept>
 
@@ -33,6 +35,25 @@ TEST(FieldTest, next) {
     field.putNext();
     EXPECT_EQ(field.getNext(0), next);
 }
+TEST(FieldTest, tsumo) {
+    auto tsumo = Tsumo::share(123);
+    EXPECT_EQ(tsumo, Tsumo::share(123));
+    EXPECT_NE(tsumo, Tsumo::share(124));
+    EXPECT_EQ(tsumo->seed(), 123);
+    EXPECT_EQ(tsumo->at(0), Tsumo(123).at(0));
+    EXPECT_EQ(tsumo->at(Tsumo::LENGTH + 5), tsumo->at(5));
+
+    FieldState3 field(123);
+    EXPECT_EQ(field.getTsumo(), tsumo);
+    for (std::size_t i = 0; i < 200; i++) {
+        EXPECT_EQ(field.getNext(0).bottom, tsumo->at(i).first);
+        EXPECT_EQ(field.getNext(0).top, tsumo->at(i).second);
+        EXPECT_EQ(field.getNext(2).bottom, tsumo->at(i + 2).first);
+        field.updateNext({field.getNext(0), actions[i % ACTIONS_NUM]});
+        field.putNext();
+        field = FieldState3(field);
+    }
+}
 TEST(FieldTest, garbage) {
     FieldState3 field;
     EXPECT_EQ(field.getGarbageNumTotal(), 0);
@@ -74,6 +95,34 @@ TEST(FieldTest, garbage) {
     EXPECT_EQ(garbage2->cancelledNum(), 0);
     EXPECT_EQ(garbage2->fellNum(), 11);
     EXPECT_FALSE(garbage2->done());
+
+    // detached()したコピーは残りの数を持つがGarbageGroupには報告しない
+    FieldState3 snapshot = field.detached();
+    EXPECT_EQ(snapshot.getGarbageNumTotal(), 39);
+    EXPECT_EQ(snapshot.cancelGarbage(10), 10);
+    EXPECT_EQ(snapshot.getGarbageNumTotal(), 29);
+    EXPECT_EQ(field.getGarbageNumTotal(), 39);
+    EXPECT_EQ(garbage2->restGarbageNum(), 39);
+}
+TEST(FieldTest, garbageFullColumn) {
+    // 埋まっている列に降るおじゃまは盤面の外に書かずに消えるが、
+    // GarbageGroupには降った数として数える
+    FieldState3 field;
+    for (std::size_t y = 0; y < FieldState3::HEIGHT; y++) {
+        field.set(2, y, Puyo::red);
+    }
+    auto garbage = std::make_shared<GarbageGroup>(12);
+    field.addGarbage(garbage);
+    std::vector<std::pair<std::size_t, std::size_t>> garbage_list;
+    field.putGarbage(&garbage_list);
+    EXPECT_EQ(garbage_list.size(), 10);
+    for (const auto &[x, y] : garbage_list) {
+        EXPECT_NE(x, 2);
+    }
+    EXPECT_EQ(field.getHeight(2), FieldState3::HEIGHT);
+    EXPECT_EQ(field.getGarbageNumTotal(), 0);
+    EXPECT_EQ(garbage->fellNum(), 12);
+    EXPECT_TRUE(garbage->done());
 }
 TEST(FieldTest, height) {
     FieldState3 field;
@@ -186,3 +235,484 @@ TEST(FieldTest, chainAll) {
     EXPECT_EQ(a.at(2).at(2), 0);
     EXPECT_EQ(a.at(3).at(2), 0);
 }
+TEST(FieldTest, fall) {
+    FieldState3 field;
+    EXPECT_FALSE(field.fall());
+    field.set(0, 0, Puyo::red);
+    field.set(0, 2, Puyo::blue);
+    field.set(0, 5, Puyo::garbage);
+    field.set(5, 12, Puyo::green);
+    EXPECT_TRUE(field.fall());
+    EXPECT_EQ(field.get(0, 0), Puyo::red);
+    EXPECT_EQ(field.get(0, 1), Puyo::blue);
+    EXPECT_EQ(field.get(0, 2), Puyo::garbage);
+    EXPECT_EQ(field.get(0, 3), Puyo::none);
+    EXPECT_EQ(field.get(0, 5), Puyo::none);
+    EXPECT_EQ(field.get(5, 0), Puyo::green);
+    EXPECT_EQ(field.get(5, 12), Puyo::none);
+    EXPECT_EQ(field.getHeight(0), 3);
+    EXPECT_EQ(field.getHeight(5), 1);
+    EXPECT_FALSE(field.fall());
+}
+TEST(FieldTest, chainGarbage) {
+    FieldState3 field;
+    for (std::size_t x = 0; x < 4; x++) {
+        field.set(x, 0, Puyo::garbage);
+        field.set(x, 1, Puyo::red);
+    }
+    field.set(4, 0, Puyo::garbage);
+    field.set(0, 2, Puyo::garbage);
+    field.set(5, 1, Puyo::garbage);
+    Chain chain = field.deleteChain(1);
+    ASSERT_EQ(chain.connections.size(), 1);
+    EXPECT_EQ(chain.connections[0], std::make_pair(Puyo::red, 4));
+    for (std::size_t x = 0; x < 4; x++) {
+        EXPECT_EQ(field.get(x, 0), Puyo::none);
+        EXPECT_EQ(field.get(x, 1), Puyo::none);
+    }
+    EXPECT_EQ(field.get(0, 2), Puyo::none);
+    EXPECT_EQ(field.get(4, 0), Puyo::garbage);
+    EXPECT_EQ(field.get(5, 1), Puyo::garbage);
+}
+TEST(BitBoardTest, shift) {
+    BitBoard b = BitBoard::cell(3, 0) | BitBoard::cell(4, 12);
+    EXPECT_EQ(b.popcount(), 2);
+    EXPECT_TRUE(b.right().test(4, 0));
+    EXPECT_TRUE(b.right().test(5, 12));
+    EXPECT_TRUE(b.left().test(2, 0));
+    EXPECT_TRUE(b.left().test(3, 12));
+    EXPECT_EQ(BitBoard::cell(5, 3).right(), BitBoard{});
+    EXPECT_EQ(BitBoard::cell(0, 3).left(), BitBoard{});
+    EXPECT_EQ(BitBoard::cell(2, 12).up(), BitBoard{});
+    EXPECT_EQ(BitBoard::cell(2, 0).down(), BitBoard{});
+    EXPECT_EQ(BitBoard::cell(2, 5).neighbors().popcount(), 4);
+    EXPECT_EQ(BitBoard::full().popcount(), 78);
+    EXPECT_EQ(BitBoard::below(1, 5).height(1), 5);
+}
+TEST(BoardTest, findGroups) {
+    PuyoBoard board;
+    EXPECT_TRUE(board.findGroups().empty());
+    board.set(0, 0, Puyo::red);
+    board.set(0, 1, Puyo::red);
+    board.set(1, 1, Puyo::red);
+    board.set(1, 0, Puyo::blue);
+    board.set(2, 0, Puyo::garbage);
+    board.set(2, 1, Puyo::red);
+    board.set(5, 5, Puyo::red);
+    auto groups = board.findGroups();
+    ASSERT_EQ(groups.size(), 3);
+    EXPECT_EQ(groups[0].color, Puyo::red);
+    EXPECT_EQ(groups[0].size, 4);
+    EXPECT_EQ(groups[0].garbage, BitBoard::cell(2, 0));
+    EXPECT_TRUE(groups[0].mask.test(2, 1));
+    EXPECT_EQ(groups[1].color, Puyo::red);
+    EXPECT_EQ(groups[1].size, 1);
+    EXPECT_EQ(groups[1].mask, BitBoard::cell(5, 5));
+    EXPECT_EQ(groups[2].color, Puyo::blue);
+    EXPECT_EQ(groups[2].garbage, BitBoard::cell(2, 0));
+
+    groups = board.findGroups(BitBoard::full(), 4);
+    ASSERT_EQ(groups.size(), 1);
+    groups = board.findGroups(BitBoard::cell(1, 0));
+    ASSERT_EQ(groups.size(), 1);
+    EXPECT_EQ(groups[0].color, Puyo::blue);
+
+    board.deleteConnection(board.findGroups(BitBoard::full(), 4)[0]);
+    EXPECT_EQ(board.get(0, 0), Puyo::none);
+    EXPECT_EQ(board.get(2, 0), Puyo::none);
+    EXPECT_EQ(board.get(1, 0), Puyo::blue);
+    EXPECT_EQ(board.get(5, 5), Puyo::red);
+}
+TEST(BoardTest, deleteChainInPlace) {
+    PuyoBoard board;
+    for (std::size_t y = 0; y < 4; y++) {
+        board.set(0, y, Puyo::green);
+        board.set(2, y, Puyo::blue);
+    }
+    board.set(1, 0, Puyo::garbage);
+    board.set(1, 1, Puyo::yellow);
+    board.set(3, 0, Puyo::garbage);
+    board.clearUpdated();
+    // updatedのマスを含まないつながりは消えない
+    EXPECT_TRUE(board.deleteChain(1).isEmpty());
+
+    board.set(2, 4, Puyo::blue);
+    Chain chain = board.deleteChain(1);
+    ASSERT_EQ(chain.connections.size(), 1);
+    EXPECT_EQ(chain.connections[0], std::make_pair(Puyo::blue, 5));
+    EXPECT_EQ(board.get(0, 0), Puyo::green);
+    EXPECT_EQ(board.get(1, 0), Puyo::none);
+    EXPECT_EQ(board.get(1, 1), Puyo::yellow);
+    EXPECT_EQ(board.get(3, 0), Puyo::none);
+    EXPECT_EQ(board.getHeight(2), 0);
+    EXPECT_TRUE(board.fall());
+    EXPECT_EQ(board.get(1, 0), Puyo::yellow);
+}
+TEST(BitBoardTest, compressColumns) {
+    std::mt19937 rnd(1);
+    for (int i = 0; i < 1000; i++) {
+        BitBoard mask{rnd() | (std::uint64_t{rnd()} << 32),
+                      rnd() | (std::uint64_t{rnd()} << 32)};
+        BitBoard b{rnd() | (std::uint64_t{rnd()} << 32),
+                   rnd() | (std::uint64_t{rnd()} << 32)};
+        mask &= BitBoard::full();
+        b &= BitBoard::full();
+        ColumnCompressor compress(mask);
+        BitBoard result = compress(b);
+        for (std::size_t x = 0; x < BitBoard::WIDTH; x++) {
+            std::size_t k = 0;
+            for (std::size_t y = 0; y < BitBoard::HEIGHT; y++) {
+                if (mask.test(x, y)) {
+                    EXPECT_EQ(result.test(x, k), b.test(x, y));
+                    k++;
+                }
+            }
+            EXPECT_EQ(compress.packedMask().height(x), k);
+            EXPECT_LE(result.height(x), k);
+        }
+    }
+}
+TEST(BoardTest, fallColumns) {
+    PuyoBoard board;
+    EXPECT_EQ(board.fallColumns(), 0);
+    board.set(1, 0, Puyo::red);
+    board.set(1, 3, Puyo::blue);
+    board.set(4, 12, Puyo::garbage);
+    board.set(5, 0, Puyo::green);
+    EXPECT_EQ(board.fallColumns(), (1u << 1) | (1u << 4));
+    EXPECT_EQ(board.get(1, 1), Puyo::blue);
+    EXPECT_EQ(board.get(4, 0), Puyo::garbage);
+    EXPECT_EQ(board.get(5, 0), Puyo::green);
+    EXPECT_EQ(board.fallColumns(), 0);
+}
+TEST(BoardTest, chainAllCache) {
+    FieldState3 field;
+    field.updateNext({Puyo::red, Puyo::red, {0, Action::Rotation::vertical}});
+    field.putNext();
+    field.updateNext(
+        {Puyo::green, Puyo::green, {1, Action::Rotation::vertical}});
+    field.putNext();
+    field.updateNext({Puyo::red, Puyo::red, {1, Action::Rotation::vertical}});
+    field.putNext();
+
+    ChainAllCache cache(16);
+    auto a = cache.calcChainAll(field.getBoard());
+    EXPECT_EQ(cache.hits(), 0);
+    EXPECT_EQ(cache.misses(), 1);
+    EXPECT_EQ(a, field.calcChainAll());
+    EXPECT_EQ(a.at(0).at(1), 1);
+    EXPECT_EQ(a.at(0).at(0), 0);
+
+    FieldState3 field2 = field;
+    field2.updateNext(
+        {Puyo::blue, Puyo::yellow, {4, Action::Rotation::vertical}});
+    field2.putNext();
+    EXPECT_EQ(cache.calcChainAll(field.getBoard()), a);
+    EXPECT_EQ(cache.hits(), 1);
+    EXPECT_EQ(cache.calcChainAll(field2.getBoard()), field2.calcChainAll());
+    EXPECT_EQ(cache.misses(), 2);
+    cache.clear();
+    EXPECT_EQ(cache.hits(), 0);
+}
+TEST(BoardTest, chainList) {
+    StaticVector<int, 4> v{1, 2};
+    v.push_back(3);
+    EXPECT_EQ(v.size(), 3);
+    EXPECT_EQ(v.back(), 3);
+    StaticVector<int, 4> w = v;
+    v.pop_back();
+    EXPECT_EQ(w.size(), 3);
+    EXPECT_NE(v, w);
+
+    PuyoBoard board;
+    for (std::size_t y = 0; y < 3; y++) {
+        board.set(0, y, Puyo::red);
+        board.set(1, y, Puyo::green);
+    }
+    board.set(0, 3, Puyo::red);
+    board.set(0, 4, Puyo::green);
+    PuyoBoard board2 = board;
+    ChainList chains;
+    board.deleteChainRecurse(chains);
+    std::vector<Chain> chains2 = board2.deleteChainRecurse();
+    ASSERT_EQ(chains.size(), 2);
+    ASSERT_EQ(chains2.size(), 2);
+    for (std::size_t i = 0; i < chains.size(); i++) {
+        EXPECT_EQ(chains[i], chains2[i]);
+        EXPECT_EQ(chains[i].chain_num, i + 1);
+    }
+    EXPECT_TRUE(board == board2);
+}
+TEST(BoardTest, heights) {
+    FieldState3 field;
+    EXPECT_EQ(field.heights(), (PuyoBoard::Heights{0, 0, 0, 0, 0, 0}));
+    field.set(1, 3, Puyo::red);
+    EXPECT_EQ(field.getHeight(1), 4);
+    field.set(1, 3, Puyo::none);
+    EXPECT_EQ(field.getHeight(1), 0);
+    for (std::size_t y = 0; y < 3; y++) {
+        field.set(0, y, Puyo::red);
+    }
+    field.set(0, 5, Puyo::blue);
+    field.set(1, 0, Puyo::red);
+    field.set(1, 1, Puyo::green);
+    EXPECT_EQ(field.heights(), (PuyoBoard::Heights{6, 2, 0, 0, 0, 0}));
+    field.fall();
+    EXPECT_EQ(field.heights(), (PuyoBoard::Heights{4, 2, 0, 0, 0, 0}));
+    field.deleteChainRecurse();
+    EXPECT_EQ(field.heights(), (PuyoBoard::Heights{1, 1, 0, 0, 0, 0}));
+    for (std::size_t x = 0; x < FieldState3::WIDTH; x++) {
+        EXPECT_EQ(field.getHeight(x), field.getBoard().occupied().height(x));
+    }
+}
+TEST(FieldTest, chainSummary) {
+    FieldState3 field, field2;
+    for (auto *f : {&field, &field2}) {
+        for (std::size_t y = 0; y < 3; y++) {
+            f->set(0, y, Puyo::red);
+            f->set(1, y, Puyo::green);
+        }
+        f->set(0, 3, Puyo::red);
+        f->set(0, 4, Puyo::green);
+    }
+    std::vector<Chain> chains = field.deleteChainRecurse();
+    ChainSummary summary = field2.deleteChainSummary();
+    ASSERT_EQ(summary.chain_num, chains.size());
+    int total = 0;
+    for (std::size_t i = 0; i < chains.size(); i++) {
+        EXPECT_EQ(summary.scores[i], chains[i].score());
+        total += chains[i].score();
+    }
+    EXPECT_EQ(summary.total_score, total);
+    EXPECT_EQ(summary.connection_num, 8);
+    EXPECT_EQ(summary.garbage, total / FieldState3::GARBAGE_RATE);
+    EXPECT_TRUE(summary.all_clear);
+    EXPECT_EQ(field2.totalScore(), field.totalScore());
+    EXPECT_TRUE(field.getBoard() == field2.getBoard());
+
+    summary = field2.deleteChainSummary();
+    EXPECT_EQ(summary.chain_num, 0);
+    EXPECT_EQ(summary.total_score, 0);
+    EXPECT_FALSE(summary.all_clear);
+}
+TEST(FieldTest, garbageQueueFull) {
+    // CAPACITYを超えるおじゃまのまとまりは追加されずに例外になる
+    GarbageQueue queue;
+    std::vector<std::unique_ptr<GarbageGroup>> groups;
+    for (std::size_t i = 0; i < GarbageQueue::CAPACITY + 8; i++) {
+        groups.push_back(std::make_unique<GarbageGroup>(2));
+    }
+    for (std::size_t i = 0; i < GarbageQueue::CAPACITY; i++) {
+        queue.push(groups[i].get());
+    }
+    EXPECT_EQ(queue.size(), GarbageQueue::CAPACITY);
+    for (std::size_t i = GarbageQueue::CAPACITY; i < groups.size(); i++) {
+        EXPECT_THROW(queue.push(groups[i].get()), std::length_error);
+    }
+    EXPECT_EQ(queue.size(), GarbageQueue::CAPACITY);
+    EXPECT_EQ(queue.totalNum(), GarbageQueue::CAPACITY * 2);
+    // 末尾と同じgroupならまとめられる
+    queue.push(groups[GarbageQueue::CAPACITY - 1].get(), 3);
+    EXPECT_EQ(queue.size(), GarbageQueue::CAPACITY);
+    EXPECT_EQ(queue.totalNum(), GarbageQueue::CAPACITY * 2 + 3);
+
+    EXPECT_EQ(queue.fall(GarbageQueue::CAPACITY * 2 + 3),
+              GarbageQueue::CAPACITY * 2 + 3);
+    EXPECT_TRUE(queue.empty());
+    EXPECT_TRUE(groups[0]->done());
+
+    // nullptrのおじゃまはいくつ追加してもまとまる
+    FieldState3 field;
+    for (std::size_t i = 0; i < GarbageQueue::CAPACITY * 2; i++) {
+        field.addGarbage(1);
+    }
+    EXPECT_EQ(field.getGarbageNumTotal(), GarbageQueue::CAPACITY * 2);
+}
+TEST(FieldTest, chainListFull) {
+    // 2連鎖の盤面で、ChainListに1つ分しか空きがなければ1連鎖目で止まる
+    FieldState3 field;
+    for (std::size_t y = 0; y < 3; y++) {
+        field.set(0, y, Puyo::red);
+        field.set(1, y, Puyo::green);
+    }
+    field.set(0, 3, Puyo::red);
+    field.set(0, 4, Puyo::green);
+    ChainList chains;
+    while (chains.size() < chains.capacity() - 1) {
+        chains.emplace_back(0);
+    }
+    field.deleteChainRecurse(chains);
+    ASSERT_EQ(chains.size(), chains.capacity());
+    EXPECT_EQ(chains.back().chain_num, 1);
+    EXPECT_EQ(field.get(0, 0), Puyo::green);
+    EXPECT_EQ(field.get(1, 0), Puyo::green);
+
+    // いっぱいなら何もしない
+    field.deleteChainRecurse(chains);
+    EXPECT_EQ(chains.size(), chains.capacity());
+    EXPECT_EQ(field.get(0, 0), Puyo::green);
+}
+TEST(FieldTest, philox) {
+    // Random123のknown answer
+    EXPECT_EQ(Philox::block(0, 0, 0),
+              (Philox::Block{0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}));
+    EXPECT_EQ(Philox::block(~0ull, ~0ull, ~0ull),
+              (Philox::Block{0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}));
+    PhiloxEngine rnd(1, 2), rnd2 = rnd;
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(rnd(), rnd2());
+        EXPECT_LT(rnd.uniform(6), 6);
+        rnd2.uniform(6);
+    }
+
+    // 同じseedならおじゃまの配置も同じ
+    auto put = [](std::uint_fast32_t seed) {
+        FieldState3 field(seed);
+        std::vector<std::pair<std::size_t, std::size_t>> garbage_list;
+        std::vector<std::shared_ptr<GarbageGroup>> garbage;
+        for (int i = 0; i < 5; i++) {
+            garbage.push_back(std::make_shared<GarbageGroup>(3));
+            field.addGarbage(garbage.back());
+            field.putGarbage(&garbage_list);
+        }
+        return garbage_list;
+    };
+    EXPECT_EQ(put(123), put(123));
+    EXPECT_EQ(put(123).size(), 15);
+}
+TEST(BoardTest, zobrist) {
+    FieldState3 field;
+    EXPECT_EQ(field.getBoard().hash(), PuyoBoard().hash());
+    for (std::size_t y = 0; y < 3; y++) {
+        field.set(0, y, Puyo::red);
+    }
+    field.set(0, 5, Puyo::red);
+    field.set(0, 6, Puyo::blue);
+    field.set(1, 0, Puyo::garbage);
+    EXPECT_NE(field.getBoard().hash(), PuyoBoard().hash());
+    // 連鎖後の盤面を直接setで作ったものと同じハッシュになる
+    field.deleteChainRecurse();
+    PuyoBoard expected;
+    expected.set(0, 0, Puyo::blue);
+    EXPECT_EQ(field.getBoard(), expected);
+    EXPECT_EQ(field.getBoard().hash(), expected.hash());
+    expected.set(0, 0, Puyo::green);
+    EXPECT_NE(field.getBoard().hash(), expected.hash());
+
+    PuyoBoard unpacked = PuyoBoard::unpack(field.getBoard().pack());
+    EXPECT_EQ(unpacked, field.getBoard());
+    EXPECT_EQ(unpacked.hash(), field.getBoard().hash());
+}
+TEST(FieldTest, pack) {
+    FieldState3 field(42);
+    field.set(0, 0, Puyo::garbage);
+    field.set(5, 2, Puyo::purple);
+    field.set(3, 4, Puyo::yellow);
+    field.updateNext({field.getNext(0), actions[7]});
+    auto garbage = std::make_shared<GarbageGroup>(40);
+    field.addGarbage(garbage);
+    field.calcGarbage(100);
+    field.putNext();
+
+    auto packed = field.pack();
+    FieldState3 field2 = FieldState3::unpack(packed);
+    EXPECT_EQ(field2.pack(), packed);
+    EXPECT_EQ(field2.pack().hash(), packed.hash());
+    EXPECT_EQ(field2.getBoard(), field.getBoard());
+    EXPECT_EQ(field2.getTsumo(), field.getTsumo());
+    EXPECT_EQ(field2.heights(), field.heights());
+    for (std::size_t i = 0; i < 3; i++) {
+        EXPECT_EQ(field2.getNext(i), field.getNext(i));
+    }
+    EXPECT_EQ(field2.getGarbageNumTotal(), 40);
+    EXPECT_EQ(field2.calcGarbage(0), field.calcGarbage(0));
+
+    // unpackしたものはGarbageGroupに報告しない
+    field2.putGarbage();
+    EXPECT_EQ(garbage->restGarbageNum(), 40);
+    EXPECT_NE(field2.pack(), packed);
+    EXPECT_NE(field2.pack().hash(), packed.hash());
+
+    // 32bitに収まらないseedも切り詰めずに持つ
+    auto big_seed = std::numeric_limits<std::uint_fast32_t>::max();
+    FieldState3 field3(big_seed);
+    FieldState3 field4 = FieldState3::unpack(field3.pack());
+    EXPECT_EQ(field4.getTsumo()->seed(), big_seed);
+    EXPECT_EQ(field4.getTsumo(), field3.getTsumo());
+    EXPECT_EQ(field4.pack(), field3.pack());
+}
+TEST(FieldTest, legalActions) {
+    FieldState3 field(1);
+    EXPECT_EQ(field.legalActions(), FieldState3::ALL_ACTIONS);
+
+    // 12段目まで埋まった列には縦に置けない
+    for (std::size_t y = 0; y < FieldState3::HEIGHT - 1; y++) {
+        field.set(0, y, Puyo::garbage);
+    }
+    for (int a = 0; a < ACTIONS_NUM; a++) {
+        bool vertical_in_0 = actions[a].bottomX() == 0 &&
+                             actions[a].topX() == 0;
+        EXPECT_EQ(field.legalActions() >> a & 1, !vertical_in_0);
+    }
+
+    std::mt19937 rnd(2);
+    for (int i = 0; i < 100; i++) {
+        FieldState3 random(i);
+        for (std::size_t x = 0; x < FieldState3::WIDTH; x++) {
+            std::size_t h = rnd() % (FieldState3::HEIGHT + 1);
+            for (std::size_t y = 0; y < h; y++) {
+                random.set(x, y, Puyo::garbage);
+            }
+        }
+        for (int a = 0; a < ACTIONS_NUM; a++) {
+            FieldState3 put = random;
+            put.updateNext({put.getNext(0), actions[a]});
+            EXPECT_EQ(random.legalActions() >> a & 1, put.putNext());
+        }
+    }
+}
+TEST(FieldTest, placementGroups) {
+    // 同じ色の組は縦置きと逆向き、横置きと1列ずれた逆向きが同じ盤面になる
+    std::mt19937 rnd(3);
+    for (int i = 0; i < 50; i++) {
+        FieldState3 field(i);
+        for (std::size_t x = 0; x < FieldState3::WIDTH; x++) {
+            std::size_t h = rnd() % FieldState3::HEIGHT;
+            for (std::size_t y = 0; y < h; y++) {
+                field.set(x, y, static_cast<Puyo>(rnd() % 4 + 1));
+            }
+        }
+        if (i % 2 == 0) {
+            PuyoPair pp = field.getNext(0);
+            pp.top = pp.bottom;
+            field.updateNext(pp);
+        }
+        auto groups = field.placementGroups();
+        std::uint32_t legal = field.legalActions();
+        std::size_t distinct = 0;
+        for (int a = 0; a < ACTIONS_NUM; a++) {
+            ASSERT_EQ(groups[a] >= 0, (legal >> a & 1) != 0);
+            if (groups[a] < 0) {
+                continue;
+            }
+            ASSERT_LE(groups[a], a);
+            distinct += groups[a] == a;
+            for (int b = 0; b <= a; b++) {
+                if (groups[b] < 0) {
+                    continue;
+                }
+                FieldState3 fa = field, fb = field;
+                fa.updateNext({fa.getNext(0), actions[a]});
+                fb.updateNext({fb.getNext(0), actions[b]});
+                fa.putNext();
+                fb.putNext();
+                EXPECT_EQ(fa.getBoard() == fb.getBoard(),
+                          groups[a] == groups[b])
+                    << a << ", " << b;
+            }
+        }
+        if (i % 2 == 0 && legal == FieldState3::ALL_ACTIONS) {
+            EXPECT_EQ(distinct, ACTIONS_NUM / 2);
+        }
+    }
+}
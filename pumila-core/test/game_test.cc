@@ -1,11 +1,36 @@
 #include "pumila/game.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
 #include <gtest/gtest.h>
 #include <memory>
+#include <new>
+#include <sstream>
 #include <pumila/pumila.h>
 #include <stdexcept>
 
 using namespace pumila;
 
+// snapshot()がヒープを確保しないことを調べるため、確保した回数を数える
+static std::atomic<std::size_t> new_count = 0;
+void *operator new(std::size_t size) {
+    new_count++;
+    if (void *p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+#if defined(__GNUC__) && !defined(__clang__)
+// 置き換えたoperator newとの組み合わせなので正しい
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
 TEST(GameTest, put) {
     auto sim = std::make_shared<GameSim>();
     EXPECT_EQ(sim->phase->get(), GameSim::Phase::free);
@@ -21,8 +46,8 @@ TEST(GameTest, put) {
     EXPECT_EQ(sim->field->get(0, 0), Puyo::green);
     EXPECT_EQ(sim->field->get(0, 1), Puyo::red);
     EXPECT_EQ(sim->current_step, current_step);
-    EXPECT_EQ(current_step->field_before.get(0, 0), Puyo::none);
-    EXPECT_EQ(current_step->field_before.get(0, 1), Puyo::none);
+    EXPECT_EQ(current_step->field_before->get(0, 0), Puyo::none);
+    EXPECT_EQ(current_step->field_before->get(0, 1), Puyo::none);
     EXPECT_FALSE(current_step->field_after.has_value());
     EXPECT_TRUE(current_step->chains.empty());
     EXPECT_EQ(current_step->garbage_send, nullptr);
@@ -36,8 +61,8 @@ TEST(GameTest, put) {
         sim->step();
     }
     EXPECT_EQ(sim->current_step, current_step);
-    EXPECT_EQ(current_step->field_before.get(0, 0), Puyo::none);
-    EXPECT_EQ(current_step->field_before.get(0, 1), Puyo::none);
+    EXPECT_EQ(current_step->field_before->get(0, 0), Puyo::none);
+    EXPECT_EQ(current_step->field_before->get(0, 1), Puyo::none);
     EXPECT_FALSE(current_step->field_after.has_value());
     EXPECT_TRUE(current_step->chains.empty());
     EXPECT_EQ(current_step->garbage_send, nullptr);
@@ -52,11 +77,13 @@ TEST(GameTest, put) {
     }
     EXPECT_EQ(sim->phase->get(), GameSim::Phase::free);
     EXPECT_NE(sim->current_step, current_step);
-    EXPECT_EQ(current_step->field_before.get(0, 0), Puyo::none);
-    EXPECT_EQ(current_step->field_before.get(0, 1), Puyo::none);
+    EXPECT_EQ(current_step->field_before->get(0, 0), Puyo::none);
+    EXPECT_EQ(current_step->field_before->get(0, 1), Puyo::none);
     ASSERT_TRUE(current_step->field_after.has_value());
     EXPECT_EQ(current_step->field_after->get(0, 0), Puyo::green);
     EXPECT_EQ(current_step->field_after->get(0, 1), Puyo::red);
+    EXPECT_TRUE(
+        sim->current_step->field_before.sharesWith(current_step->field_after));
     EXPECT_TRUE(current_step->chains.empty());
     EXPECT_EQ(current_step->garbage_send, nullptr);
     EXPECT_FALSE(current_step->op_field_before.has_value());
@@ -118,3 +145,436 @@ TEST(GameTest, chain) {
     EXPECT_EQ(sim2->current_step->garbage_recv.size(), 1);
     EXPECT_EQ(current_step->garbage_send, sim2->current_step->garbage_recv[0]);
 }
+
+TEST(GameTest, sharedField) {
+    SharedFieldState3 shared;
+    EXPECT_FALSE(shared.has_value());
+    EXPECT_FALSE(shared.copy().has_value());
+    shared.emplace(123);
+    ASSERT_TRUE(shared.has_value());
+    EXPECT_EQ(shared->getNext(0), FieldState3(123).getNext(0));
+    {
+        auto field = shared.lock();
+        field->set(0, 0, Puyo::red);
+        EXPECT_EQ(shared->get(0, 0), Puyo::red);
+    }
+    auto copied = shared.copy();
+    ASSERT_TRUE(copied.has_value());
+    EXPECT_EQ(copied->get(0, 0), Puyo::red);
+    EXPECT_TRUE(std::is_trivially_copyable_v<PuyoBoard>);
+}
+
+TEST(Pumila14Test, featureCache) {
+    FieldState3 field(1);
+    for (std::size_t y = 0; y < 3; y++) {
+        field.set(0, y, Puyo::red);
+        field.set(1, y, Puyo::blue);
+    }
+    field.set(2, 0, Puyo::purple);
+    StepResult result{FieldSnapshot(field)};
+
+    auto groups = field.placementGroups();
+    std::size_t distinct = 0;
+    for (int a = 0; a < ACTIONS_NUM; a++) {
+        distinct += groups[a] == a;
+    }
+    auto &cache = Pumila14::featureCache();
+    cache.clear();
+    Matrix m1 = Pumila14::calcAction(result);
+    EXPECT_EQ(cache.hits(), 0);
+    EXPECT_EQ(cache.misses(), distinct);
+    Matrix m2 = Pumila14::calcAction(result);
+    EXPECT_EQ(cache.hits(), distinct);
+    for (std::size_t i = 0; i < ACTIONS_NUM * Pumila14::FEATURE_NUM; i++) {
+        ASSERT_EQ(m1.ptr()[i], m2.ptr()[i]);
+    }
+    // 置いて赤が消える手は連鎖の点数が入る
+    bool chained = false;
+    for (int a = 0; a < ACTIONS_NUM; a++) {
+        chained |= m1.rowPtr<Pumila14::InFeature>(a)->score_diff[0] > 0;
+    }
+    EXPECT_EQ(chained, field.getNext(0).bottom == Puyo::red ||
+                           field.getNext(0).top == Puyo::red ||
+                           field.getNext(0).bottom == Puyo::blue ||
+                           field.getNext(0).top == Puyo::blue);
+}
+
+TEST(GameTest, fastForward) {
+    // 毎フレームstep()する場合とfastForward()する場合、
+    // headlessの場合で同じ結果になる
+    auto play = [](bool fast, bool headless) {
+        auto sim = std::make_shared<GameSim>(1);
+        auto sim2 = std::make_shared<GameSim>(2);
+        sim->setOpponentSim(sim2);
+        sim->headless = sim2->headless = headless;
+        std::vector<std::shared_ptr<GameSim>> sims = {sim, sim2};
+        std::vector<std::pair<int, FieldState3::Packed>> log;
+        int frame = 0, turn = 0;
+        auto low = [](const std::shared_ptr<GameSim> &s) {
+            auto h = s->field->heights();
+            return *std::max_element(h.begin(), h.end()) < 11;
+        };
+        while (frame < 20000 && low(sim) && low(sim2)) {
+            for (const auto &s : sims) {
+                if (s->needsAction()) {
+                    s->put(actions[Philox::block(3, turn++)[0] % ACTIONS_NUM]);
+                    log.emplace_back(frame, s->field.copy()->pack());
+                }
+            }
+            if (fast) {
+                frame += GameSim::fastForward(sims, 20000 - frame);
+            } else {
+                for (const auto &s : sims) {
+                    s->step();
+                    auto fall_phase = s->phase.getIf<GameSim::FallPhase>();
+                    if (fall_phase) {
+                        EXPECT_EQ(fall_phase->display_field.has_value(),
+                                  !headless);
+                    }
+                }
+                frame++;
+            }
+        }
+        return std::make_pair(log, sim->field->totalScore() +
+                                       sim2->field->totalScore());
+    };
+    auto slow = play(false, false), fast = play(true, false);
+    EXPECT_GT(slow.first.size(), 20);
+    EXPECT_GT(slow.second, 0);
+    EXPECT_EQ(slow.first.size(), fast.first.size());
+    EXPECT_TRUE(slow == fast);
+    EXPECT_TRUE(slow == play(false, true));
+    EXPECT_TRUE(slow == play(true, true));
+}
+
+TEST(VecGameTest, step) {
+    // 1ゲームずつputTurn()で進めた場合と同じ結果になる
+    constexpr std::size_t env_num = 3;
+    VecGameSim vec(env_num, false, 5);
+    std::vector<PhiloxEngine> rnds;
+    std::vector<std::shared_ptr<GameSim>> refs;
+    for (std::size_t i = 0; i < env_num; i++) {
+        rnds.emplace_back(5, i);
+        refs.push_back(std::make_shared<GameSim>(rnds[i]()));
+    }
+    std::vector<int> a(env_num);
+    int done_num = 0;
+    double reward_sum = 0;
+    for (std::size_t t = 0; t < 300; t++) {
+        for (std::size_t i = 0; i < env_num; i++) {
+            a[i] = Philox::block(7, t * env_num + i)[0] % ACTIONS_NUM;
+        }
+        vec.step(a);
+        for (std::size_t i = 0; i < env_num; i++) {
+            int score = refs[i]->field->totalScore();
+            refs[i]->putTurn(actions[a[i]]);
+            EXPECT_EQ(vec.rewards()[i], refs[i]->field->totalScore() - score);
+            EXPECT_EQ(vec.dones()[i], refs[i]->is_over);
+            reward_sum += vec.rewards()[i];
+            if (refs[i]->is_over) {
+                done_num++;
+                refs[i]->current_step = nullptr;
+                refs[i]->reset(rnds[i]());
+            }
+            ASSERT_TRUE(vec.needsAction()[i]);
+            EXPECT_EQ(vec.sim(i)->field.copy()->pack(),
+                      refs[i]->field.copy()->pack());
+        }
+    }
+    EXPECT_GT(reward_sum, 0);
+    EXPECT_GT(done_num, 0);
+    Matrix m = Pumila14::calcAction(*refs[1]->current_step);
+    for (std::size_t r = 0; r < ACTIONS_NUM; r++) {
+        for (std::size_t c = 0; c < Pumila14::FEATURE_NUM; c++) {
+            ASSERT_EQ(vec.observations().at(ACTIONS_NUM + r, c), m.at(r, c));
+        }
+    }
+
+    a[0] = ACTIONS_NUM;
+    EXPECT_THROW(vec.step(a), std::out_of_range);
+}
+TEST(VecGameTest, versus) {
+    VecGameSim vec(2, true, 9);
+    EXPECT_EQ(vec.agentNum(), 4);
+    std::vector<int> a(vec.agentNum());
+    int done_num = 0;
+    for (std::size_t t = 0; t < 500; t++) {
+        for (std::size_t i = 0; i < a.size(); i++) {
+            a[i] = Philox::block(11, t * a.size() + i)[0] % ACTIONS_NUM;
+        }
+        vec.step(a);
+        for (std::size_t env = 0; env < 2; env++) {
+            // 各ゲームで少なくとも1人は次のactionを待っている
+            EXPECT_TRUE(vec.needsAction()[env * 2] ||
+                        vec.needsAction()[env * 2 + 1]);
+            EXPECT_EQ(vec.dones()[env * 2], vec.dones()[env * 2 + 1]);
+            done_num += vec.dones()[env * 2];
+            for (std::size_t i = env * 2; i < env * 2 + 2; i++) {
+                if (!vec.needsAction()[i]) {
+                    EXPECT_EQ(vec.rewards()[i], 0);
+                    EXPECT_EQ(vec.observations().at(i * ACTIONS_NUM, 0), 0);
+                }
+            }
+        }
+    }
+    EXPECT_GT(done_num, 0);
+}
+TEST(ArenaTest, run) {
+    Arena arena(Arena::greedyPolicy(), Arena::randomPolicy(3));
+    arena.record = true;
+    auto result = arena.run(12, 1);
+    EXPECT_EQ(result.games, 12);
+    EXPECT_EQ(result.wins[0] + result.wins[1] + result.draws, 12);
+    EXPECT_GT(result.wins[0], result.wins[1]);
+    ASSERT_EQ(result.records.size(), 12);
+    std::size_t turns = 0;
+    for (std::size_t n = 0; n <= MAX_CHAIN_NUM; n++) {
+        turns += result.chain_hist[0][n];
+    }
+    EXPECT_GT(turns, 0);
+    EXPECT_GT(result.score_sum[0], 0);
+
+    // 並列に実行しても各ゲームの結果はseedだけから決まる
+    auto game = arena.playGame(PhiloxEngine(1, 5)());
+    EXPECT_EQ(game.winner, result.records[5].winner);
+    EXPECT_EQ(game.frames, result.records[5].frames);
+    EXPECT_EQ(game.score, result.records[5].score);
+    EXPECT_EQ(game.steps[0].size(), result.records[5].steps[0].size());
+
+    Arena bad([](const StepResult &) { return ACTIONS_NUM; },
+              Arena::randomPolicy(0));
+    EXPECT_THROW(bad.run(4, 0), std::out_of_range);
+}
+TEST(GameTest, snapshotCost) {
+    // 連鎖中・おじゃま待ち・softPut中のsnapshot()とrestore()は
+    // ヒープを確保せず、current_stepなどは次に書き換える時にコピーする
+    auto sim = std::make_shared<GameSim>(1);
+    auto sim2 = std::make_shared<GameSim>(1);
+    sim->field->set(0, 0, Puyo::red);
+    sim->field->set(0, 1, Puyo::red);
+    sim->field->updateNext({Puyo::red, Puyo::red});
+    sim->put({0, Action::Rotation::vertical});
+    sim->step();
+    ASSERT_EQ(sim->phase->get(), GameSim::Phase::fall);
+    ASSERT_EQ(sim->current_step->chains.size(), 1);
+    sim->field.addGarbage(std::make_shared<GarbageGroup>(8));
+    sim2->softPut({5, Action::Rotation::horizontal_left});
+    sim2->step();
+
+    std::size_t count = new_count;
+    GameSim::Snapshot s = sim->snapshot(), s2 = sim2->snapshot();
+    sim->restore(s);
+    sim2->restore(s2);
+    EXPECT_EQ(new_count - count, 0);
+    EXPECT_EQ(s.current_step, sim->current_step);
+    // 大きいのはfield 1つ分とおじゃまの表だけ
+    // (フェーズの表示用の盤面などはコピーしない)
+    EXPECT_LE(sizeof(GameSim::Snapshot),
+              sizeof(FieldState3) + sizeof(s.garbage_keep) +
+                  sizeof(s.garbage_counts) + 256);
+
+    while (sim->phase->get() != GameSim::Phase::free) {
+        sim->step();
+    }
+    EXPECT_NE(s.current_step, sim->current_step);
+    EXPECT_FALSE(s.current_step->field_after);
+    EXPECT_EQ(s.current_step->chains.size(), 1);
+    EXPECT_EQ(sim->field->getGarbageNumTotal(), 0);
+    sim->restore(s);
+    EXPECT_EQ(sim->field->getGarbageNumTotal(), 8);
+    EXPECT_EQ(sim->current_step->chains.size(), 1);
+}
+TEST(GameTest, softPut) {
+    // softPut()で動かした結果がput()と同じになり、
+    // 同じ盤面・目標の2回目はキャッシュを使う
+    constexpr std::array<std::size_t, FieldState3::WIDTH> heights = {3, 5, 0,
+                                                                     0, 8, 2};
+    std::size_t hits = 0;
+    for (int round = 0; round < 2; round++) {
+        for (int a = 0; a < ACTIONS_NUM; a++) {
+            auto sim = std::make_shared<GameSim>(1);
+            auto sim2 = std::make_shared<GameSim>(1);
+            for (const auto &s : {sim, sim2}) {
+                for (std::size_t x = 0; x < FieldState3::WIDTH; x++) {
+                    for (std::size_t y = 0; y < heights[x]; y++) {
+                        s->field->set(x, y, Puyo::garbage);
+                    }
+                }
+            }
+            sim->softPut(actions[a]);
+            sim2->put(actions[a]);
+            int frames = 0;
+            while (sim->phase->get() == GameSim::Phase::free && frames < 1000) {
+                sim->step();
+                frames++;
+            }
+            sim2->step();
+            EXPECT_LT(frames, 40);
+            EXPECT_EQ(sim->field.copy()->pack().board,
+                      sim2->field.copy()->pack().board);
+        }
+        if (round == 0) {
+            hits = SoftPutPlanner::shared().hits();
+        }
+    }
+    // (衝突して上書きされた分はミスになる)
+    EXPECT_GE(SoftPutPlanner::shared().hits(), hits + ACTIONS_NUM / 2);
+}
+TEST(GameTest, softPutQuickTurn) {
+    // 幅1の溝の中では回転に失敗した後のクイックターンでしか上下を返せない。
+    // 入力列もrotPair()と同じ規則で回転し、ずらした回転と失敗の回数の上限
+    // (ROT_FAIL_COUNT = 10) を守る
+    auto sim = std::make_shared<GameSim>(1);
+    auto sim2 = std::make_shared<GameSim>(1);
+    for (const auto &s : {sim, sim2}) {
+        for (std::size_t y = 0; y < 8; y++) {
+            s->field->set(1, y, Puyo::garbage);
+            s->field->set(3, y, Puyo::garbage);
+        }
+        while (s->field->getNext(0).y >= 5) {
+            s->step();
+        }
+    }
+    auto field = sim->field.copy();
+    PuyoPair pp = field->getNext(0);
+    auto f_phase = sim->phase.getIf<GameSim::FreePhase>();
+    ASSERT_NE(f_phase, nullptr);
+    Action target(2, Action::Rotation::vertical_inverse);
+    auto plan = SoftPutPlanner::search(*field, pp, f_phase->put_t, 0, 0, 0,
+                                       target, sim->soft_put_interval);
+    ASSERT_TRUE(plan.has_value());
+    std::vector<int> rots;
+    for (const auto &frame : *plan) {
+        if (frame.rot != 0) {
+            rots.push_back(frame.rot);
+        }
+    }
+    EXPECT_EQ(rots.size(), 2u);
+    EXPECT_EQ(plan->back().rot_fail_count, 1);
+    EXPECT_FALSE(SoftPutPlanner::search(*field, pp, f_phase->put_t, 0, 0, 9,
+                                        target, sim->soft_put_interval));
+    EXPECT_TRUE(SoftPutPlanner::search(*field, pp, f_phase->put_t, 0, 0, 8,
+                                       target, sim->soft_put_interval));
+
+    sim->softPut(target);
+    int frames = 0;
+    while (sim->phase->get() == GameSim::Phase::free && frames < 1000) {
+        sim->step();
+        frames++;
+    }
+    sim2->put(target);
+    sim2->step();
+    EXPECT_LE(frames, static_cast<int>(plan->size()));
+    EXPECT_EQ(sim->field.copy()->pack().board,
+              sim2->field.copy()->pack().board);
+}
+TEST(GameTest, record) {
+    // 対戦を記録し、再生した盤面と時刻が各ターンの開始時と一致する
+    std::stringstream stream;
+    std::array<std::shared_ptr<GameSim>, 2> sims = {
+        std::make_shared<GameSim>(), std::make_shared<GameSim>()};
+    sims[0]->setOpponentSim(sims[1]);
+    auto writer = std::make_shared<GameRecordWriter>(stream);
+    sims[0]->recorder = writer;
+    for (const auto &sim : sims) {
+        sim->reset(7);
+    }
+    std::vector<std::shared_ptr<GameSim>> sims_v(sims.begin(), sims.end());
+    std::array<Arena::Policy, 2> policies = {Arena::randomPolicy(1),
+                                             Arena::greedyPolicy()};
+    std::vector<FieldState3::Packed> fields;
+    std::vector<int> frames;
+    while (!sims[0]->is_over && !sims[1]->is_over && fields.size() < 200) {
+        for (std::size_t p = 0; p < 2; p++) {
+            if (sims[p]->needsAction()) {
+                if (p == 0) {
+                    fields.push_back(
+                        sims[p]->current_step->field_before->pack());
+                    frames.push_back(sims[p]->frame_count);
+                }
+                sims[p]->put(actions[policies[p](*sims[p]->current_step)]);
+            }
+        }
+        GameSim::fastForward(sims_v);
+    }
+    writer->finish();
+    EXPECT_EQ(writer->games(), 1);
+    ASSERT_GT(writer->turns(), 10);
+
+    auto record = GameRecord::read(stream);
+    ASSERT_TRUE(record);
+    EXPECT_FALSE(GameRecord::read(stream));
+    EXPECT_EQ(record->seed, 7);
+    ASSERT_EQ(record->turns.size(), writer->turns());
+    EXPECT_LT(stream.str().size(), record->turns.size() * 4);
+    std::size_t recv = 0;
+    for (const auto &turn : record->turns) {
+        recv += turn.garbage_recv;
+    }
+    EXPECT_GT(recv, 0);
+
+    GameReplayer replayer(*record);
+    for (std::size_t t = 0; t <= record->turns.size() && t < fields.size();
+         t++) {
+        EXPECT_EQ(replayer.field().pack(), fields[t]) << "turn " << t;
+        EXPECT_EQ(replayer.frame(), frames[t]) << "turn " << t;
+        if (!replayer.done()) {
+            replayer.step();
+        }
+    }
+    replayer.seek(3);
+    EXPECT_EQ(replayer.field().pack(), fields[3]);
+
+    // 書き直しても同じバイト列になる
+    std::stringstream stream2;
+    record->write(stream2);
+    EXPECT_EQ(stream2.str(), stream.str());
+}
+TEST(GameTest, snapshot) {
+    // 対戦の途中でsnapshotを取り、先に進めてからrestoreすると
+    // 同じactionで同じ結果になる (おじゃまのやり取りを含む)
+    std::array<std::shared_ptr<GameSim>, 2> sims = {
+        std::make_shared<GameSim>(3), std::make_shared<GameSim>(3)};
+    sims[0]->setOpponentSim(sims[1]);
+    std::vector<std::shared_ptr<GameSim>> sims_v(sims.begin(), sims.end());
+    std::array<Arena::Policy, 2> policies = {Arena::randomPolicy(2),
+                                             Arena::greedyPolicy()};
+    auto play = [&](int turns) {
+        std::vector<std::pair<FieldState3::Packed, int>> trace;
+        for (int t = 0; t < turns && !sims[0]->is_over && !sims[1]->is_over;
+             t++) {
+            for (std::size_t p = 0; p < 2; p++) {
+                if (sims[p]->needsAction()) {
+                    sims[p]->put(
+                        actions[policies[p](*sims[p]->current_step)]);
+                }
+            }
+            GameSim::fastForward(sims_v);
+            for (const auto &sim : sims) {
+                trace.emplace_back(sim->field->pack(), sim->frame_count);
+            }
+        }
+        return trace;
+    };
+    play(10);
+    // 連鎖の途中からでも戻せる
+    sims[1]->put(actions[policies[1](*sims[1]->current_step)]);
+    for (int f = 0; f < 3; f++) {
+        for (const auto &sim : sims) {
+            sim->step();
+        }
+    }
+    std::array<GameSim::Snapshot, 2> snapshots = {sims[0]->snapshot(),
+                                                  sims[1]->snapshot()};
+    auto trace = play(40);
+    ASSERT_GT(trace.size(), 40);
+    for (int i = 0; i < 2; i++) {
+        for (std::size_t p = 0; p < 2; p++) {
+            sims[p]->restore(snapshots[p]);
+        }
+        EXPECT_EQ(play(40), trace);
+    }
+    EXPECT_TRUE(std::any_of(trace.begin(), trace.end(), [](const auto &t) {
+        return t.first.garbage_num > 0;
+    }));
+}
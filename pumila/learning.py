@@ -100,7 +100,12 @@ class Learning:
         next_feat_batch = (
             torch.from_numpy(next_feat_batch_np).to(self.dtype).to(self.device)
         )
-        next_state_values = self.target_net(next_feat_batch).max(1).indices.squeeze()
+        next_legal_batch = torch.from_numpy(
+            np.array([self.Net.legal_actions(data.step.next()) for data in batch])
+        ).to(self.device)
+        next_q_batch = self.target_net(next_feat_batch).squeeze(2)
+        next_q_batch = next_q_batch.masked_fill(~next_legal_batch, -math.inf)
+        next_state_values = next_q_batch.max(1).indices
         next_state_values = torch.tensor(
             next_state_values.tolist() * 24, dtype=self.dtype, device=self.device
         )
@@ -146,13 +151,19 @@ class Learning:
         if random_eps is None:
             self.steps_done += 1
             random_eps = self.random_eps()
+        legal = self.Net.legal_actions(data.step)
         if random.random() > random_eps:
             feat_t = torch.from_numpy(data.feat).to(self.dtype).to(self.device)
+            legal_t = torch.from_numpy(legal).to(self.device)
             with torch.no_grad():
-                return self.policy_net(feat_t).max(0).indices.view(1, 1)
+                q = self.policy_net(feat_t).squeeze(1)
+                q = q.masked_fill(~legal_t, -math.inf)
+                return q.max(0).indices.view(1, 1)
         else:
             return torch.tensor(
-                [[random.randint(0, 21)]], device=self.device, dtype=torch.long
+                [[random.choice(np.flatnonzero(legal).tolist())]],
+                device=self.device,
+                dtype=torch.long,
             )
 
     def push_step(self, data: ReplayData, action: int) -> None:
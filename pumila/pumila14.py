@@ -19,6 +19,12 @@ class Net14(nn.Module):
     def calc_action(state: StepResult) -> np.ndarray:
         return np.array(Pumila14.calc_action(state), copy=False)
 
+    @staticmethod
+    def legal_actions(state: StepResult) -> np.ndarray:
+        mask = np.array(Pumila14.legal_actions(state), dtype=bool)
+        # 置ける場所がなければどこに置いてもゲームオーバーなので全部許す
+        return mask if mask.any() else np.ones_like(mask)
+
     @staticmethod
     def rotate_color(feat: np.ndarray) -> np.ndarray:
         return np.array(Pumila14.rotate_color(feat), copy=False)